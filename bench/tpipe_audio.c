@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Simulates an audio callback which drains a pipe of control messages at the
+// start of every block, while a background thread writes bursts of messages. The
+// callback thread runs under SCHED_FIFO if permitted, otherwise under normal
+// scheduling. Reports the distribution of the time taken to drain the pipe and of
+// the lateness of the callback, and the number of blocks which missed their
+// deadline. Optionally, each block also spins for a given time to simulate signal
+// processing.
+//
+// cc -O2 -pthread -I.. tpipe_audio.c ../tinypipe.c ../tinypipe_histogram.c -o tpipe_audio
+// ./tpipe_audio [-r sample rate] [-f block frames] [-d seconds] [-w dsp microseconds]
+//               [-s message bytes] [-B burst messages] [-i burst interval microseconds]
+//               [-p pipe bytes] [-P producer cpu] [-C callback cpu]
+
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+#include "tinypipe_histogram.h"
+#include "tpipe_bench.h"
+
+typedef struct Config {
+  int sampleRate;
+  int blockFrames;
+  double seconds;
+  int dspMicroseconds;
+  int messageBytes;
+  int burstMessages;
+  int burstMicroseconds;
+  int pipeBytes;
+  int producerCpu;
+  int callbackCpu;
+} Config;
+
+static TinyPipe pipe_;
+static Config config;
+static volatile int running;
+static long droppedMessages;
+static long producedMessages;
+
+static void addNanoseconds(struct timespec *ts, long nanoseconds) {
+  ts->tv_nsec += nanoseconds;
+  while (ts->tv_nsec >= 1000000000L) {
+    ts->tv_nsec -= 1000000000L;
+    ts->tv_sec += 1;
+  }
+}
+
+static double getNanosecondsSince(const struct timespec *ts) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - ts->tv_sec) * 1e9 + (now.tv_nsec - ts->tv_nsec);
+}
+
+// Writes a burst of messages at regular intervals. Messages which do not fit are
+// dropped, as a control thread should never wait for the audio thread.
+static void *produce(void *arg) {
+  (void) arg;
+  bench_pinThread(config.producerCpu);
+  char *message = (char *) malloc(config.messageBytes);
+  assert(message != NULL);
+  memset(message, 1, config.messageBytes);
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (running) {
+    for (int i = 0; i < config.burstMessages; ++i) {
+      if (tpipe_write(&pipe_, message, config.messageBytes)) producedMessages++;
+      else droppedMessages++;
+    }
+    addNanoseconds(&next, 1000L * config.burstMicroseconds);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  free(message);
+  return NULL;
+}
+
+// Raises the calling thread to SCHED_FIFO. Returns 1 on success.
+static int setRealtimePriority(void) {
+#if __linux__
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+  const int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (result != 0) {
+    fprintf(stderr, "SCHED_FIFO is not permitted (%s), using normal scheduling\n", strerror(result));
+    return 0;
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static void printHistogram(const char *name, const TinyPipeHistogram *h) {
+  printf(" %s_p50_ns=%llu %s_p99_ns=%llu %s_p99.9_ns=%llu %s_max_ns=%llu",
+      name, (unsigned long long) tpipe_histogramGetPercentile(h, 50.0),
+      name, (unsigned long long) tpipe_histogramGetPercentile(h, 99.0),
+      name, (unsigned long long) tpipe_histogramGetPercentile(h, 99.9),
+      name, (unsigned long long) tpipe_histogramGetPercentile(h, 100.0));
+}
+
+int main(int argc, char *argv[]) {
+  config.sampleRate = 48000;
+  config.blockFrames = 64;
+  config.seconds = 10.0;
+  config.dspMicroseconds = 0;
+  config.messageBytes = 64;
+  config.burstMessages = 256;
+  config.burstMicroseconds = 10000;
+  config.pipeBytes = 64 * 1024;
+  config.producerCpu = -1;
+  config.callbackCpu = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:f:d:w:s:B:i:p:P:C:")) != -1) {
+    switch (opt) {
+      case 'r': config.sampleRate = atoi(optarg); break;
+      case 'f': config.blockFrames = atoi(optarg); break;
+      case 'd': config.seconds = atof(optarg); break;
+      case 'w': config.dspMicroseconds = atoi(optarg); break;
+      case 's': config.messageBytes = atoi(optarg); break;
+      case 'B': config.burstMessages = atoi(optarg); break;
+      case 'i': config.burstMicroseconds = atoi(optarg); break;
+      case 'p': config.pipeBytes = atoi(optarg); break;
+      case 'P': config.producerCpu = atoi(optarg); break;
+      case 'C': config.callbackCpu = atoi(optarg); break;
+      default: {
+        fprintf(stderr, "usage: %s [-r rate] [-f frames] [-d seconds] [-w us] [-s bytes] "
+            "[-B messages] [-i us] [-p bytes] [-P cpu] [-C cpu]\n", argv[0]);
+        return 1;
+      }
+    }
+  }
+
+  const long periodNanoseconds = (long) (1e9 * config.blockFrames / config.sampleRate);
+  const long numBlocks = (long) (config.seconds * config.sampleRate / config.blockFrames);
+  static TinyPipeHistogram drainNanoseconds;
+  static TinyPipeHistogram latenessNanoseconds;
+  tpipe_histogramClear(&drainNanoseconds);
+  tpipe_histogramClear(&latenessNanoseconds);
+  tpipe_init(&pipe_, config.pipeBytes);
+
+  bench_pinThread(config.callbackCpu);
+  const int realtime = setRealtimePriority();
+  const double ticksPerNanosecond = bench_getTicksPerSecond() / 1e9;
+
+  running = 1;
+  pthread_t producer;
+  pthread_create(&producer, NULL, produce, NULL);
+
+  long misses = 0;
+  long consumedMessages = 0;
+  int maxMessagesPerBlock = 0;
+  uint64_t checksum = 0;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  for (long b = 0; b < numBlocks; ++b) {
+    // wait for the start of the block, as the audio driver would call back
+    struct timespec start = deadline;
+    addNanoseconds(&deadline, periodNanoseconds);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start, NULL);
+    const double lateness = getNanosecondsSince(&start);
+
+    // drain all control messages
+    const uint64_t drainStart = bench_getTicks();
+    int messages = 0;
+    while (tpipe_hasData(&pipe_)) {
+      int len = 0;
+      const char *buffer = tpipe_getReadBuffer(&pipe_, &len);
+      for (int j = 0; j < len; j += 64) checksum += (uint8_t) buffer[j];
+      tpipe_consume(&pipe_);
+      ++messages;
+    }
+    const uint64_t drainTicks = bench_getTicks() - drainStart;
+
+    // simulate processing the block
+    if (config.dspMicroseconds > 0) {
+      const uint64_t dspEnd = bench_getTicks() + (uint64_t) (1000.0 * config.dspMicroseconds * ticksPerNanosecond);
+      while (bench_getTicks() < dspEnd) bench_pause();
+    }
+
+    // the block is late if it finishes after the next one should start
+    if (getNanosecondsSince(&start) > periodNanoseconds) ++misses;
+    tpipe_histogramRecord(&drainNanoseconds, (uint64_t) (drainTicks / ticksPerNanosecond));
+    tpipe_histogramRecord(&latenessNanoseconds, (uint64_t) (lateness > 0.0 ? lateness : 0.0));
+    consumedMessages += messages;
+    if (messages > maxMessagesPerBlock) maxMessagesPerBlock = messages;
+  }
+
+  running = 0;
+  pthread_join(producer, NULL);
+  while (tpipe_hasData(&pipe_)) {
+    tpipe_consume(&pipe_);
+    ++consumedMessages;
+  }
+  assert(consumedMessages == producedMessages);
+  (void) checksum;
+
+  printf("scheduling=%s rate=%d frames=%d period_ns=%ld blocks=%ld misses=%ld "
+      "messages=%ld dropped=%ld max_messages_per_block=%d",
+      realtime ? "fifo" : "normal", config.sampleRate, config.blockFrames, periodNanoseconds,
+      numBlocks, misses, producedMessages, droppedMessages, maxMessagesPerBlock);
+  printHistogram("drain", &drainNanoseconds);
+  printHistogram("lateness", &latenessNanoseconds);
+  printf("\n");
+
+  tpipe_free(&pipe_);
+  return 0;
+}
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Helpers shared by the multi-threaded benchmarks. Define _GNU_SOURCE before
+// including any system headers to enable thread pinning on Linux.
+
+#ifndef _TPIPE_BENCH_H_
+#define _TPIPE_BENCH_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+#endif
+
+#if __SSE2__
+  #include <emmintrin.h>
+  #define bench_pause() _mm_pause()
+#else
+  #define bench_pause()
+#endif
+
+#if (__x86_64__ || __i386__) && __GNUC__
+  #include <x86intrin.h>
+#endif
+
+static inline double bench_getSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Returns a cheap timestamp: the TSC on x86, otherwise nanoseconds from
+ * CLOCK_MONOTONIC. See bench_getTicksPerSecond().
+ */
+static inline uint64_t bench_getTicks(void) {
+#if (__x86_64__ || __i386__) && __GNUC__
+  return (uint64_t) __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/**
+ * Measures the rate of bench_getTicks() against CLOCK_MONOTONIC. This takes
+ * about 100ms.
+ */
+static inline double bench_getTicksPerSecond(void) {
+  const double t0 = bench_getSeconds();
+  const uint64_t ticks0 = bench_getTicks();
+  double t1;
+  do {
+    t1 = bench_getSeconds();
+  } while ((t1 - t0) < 0.1);
+  return (double) (bench_getTicks() - ticks0) / (t1 - t0);
+}
+
+/**
+ * Pins the calling thread to a CPU.
+ *
+ * @param cpu  The CPU index. Negative values leave the thread unpinned.
+ *
+ * @return  0 on success.
+ */
+static inline int bench_pinThread(int cpu) {
+#if __linux__
+  if (cpu < 0) return 0;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void) cpu;
+  return 0;
+#endif
+}
+
+/**
+ * Waits briefly while polling a pipe. The thread yields every so often so that
+ * the benchmarks still make progress when both threads share a CPU.
+ *
+ * @param spins  A counter which should be reset to 0 whenever polling succeeds.
+ */
+static inline void bench_relax(int *spins) {
+  if ((++*spins & 0x3FF) == 0) sched_yield();
+  else bench_pause();
+}
+
+/**
+ * Parses a comma-separated list of integers, e.g. "64,4096,0x10000".
+ *
+ * @param arg  The list.
+ * @param values  The array to fill.
+ * @param maxValues  The length of the array.
+ *
+ * @return  The number of values parsed.
+ */
+static inline int bench_parseList(const char *arg, int *values, int maxValues) {
+  int n = 0;
+  const char *p = arg;
+  while ((n < maxValues) && (*p != '\0')) {
+    char *end = NULL;
+    values[n++] = (int) strtol(p, &end, 0);
+    if (end == p) return n - 1; // not a number
+    p = (*end == ',') ? (end + 1) : end;
+  }
+  return n;
+}
+
+// Reads an integer from a file in sysfs. Returns -1 if it cannot be read.
+static inline int bench_readSysfsInt(const char *format, int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), format, cpu);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) return -1;
+  int value = -1;
+  if (fscanf(f, "%d", &value) != 1) value = -1;
+  fclose(f);
+  return value;
+}
+
+/**
+ * Finds a pair of CPUs with the given placement relative to each other, from the
+ * CPU topology in sysfs.
+ *
+ * @param placement  "smt" for SMT siblings of the same core, "core" for different
+ *                   cores of the same socket, or "socket" for different sockets.
+ * @param producerCpu  Filled with the first CPU.
+ * @param consumerCpu  Filled with the second CPU.
+ *
+ * @return  0 on success, or -1 if the machine has no such pair of CPUs.
+ */
+static inline int bench_findCpuPair(const char *placement, int *producerCpu, int *consumerCpu) {
+  static const char *const coreFormat = "/sys/devices/system/cpu/cpu%d/topology/core_id";
+  static const char *const packageFormat = "/sys/devices/system/cpu/cpu%d/topology/physical_package_id";
+  const int numCpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  for (int a = 0; a < numCpus; ++a) {
+    const int coreA = bench_readSysfsInt(coreFormat, a);
+    const int packageA = bench_readSysfsInt(packageFormat, a);
+    if ((coreA < 0) || (packageA < 0)) continue;
+    for (int b = a + 1; b < numCpus; ++b) {
+      const int coreB = bench_readSysfsInt(coreFormat, b);
+      const int packageB = bench_readSysfsInt(packageFormat, b);
+      if ((coreB < 0) || (packageB < 0)) continue;
+      int match = 0;
+      if (strcmp(placement, "smt") == 0) match = (packageA == packageB) && (coreA == coreB);
+      else if (strcmp(placement, "core") == 0) match = (packageA == packageB) && (coreA != coreB);
+      else if (strcmp(placement, "socket") == 0) match = (packageA != packageB);
+      if (match) {
+        *producerCpu = a;
+        *consumerCpu = b;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+enum {
+  BENCH_CYCLES,
+  BENCH_INSTRUCTIONS,
+  BENCH_LLC_MISSES,
+  BENCH_HITM, // loads which hit a modified line in another core's cache
+  BENCH_NUM_COUNTERS
+};
+
+static const char *const bench_counterNames[BENCH_NUM_COUNTERS] = {
+  "cycles", "instructions", "llc_misses", "hitm"
+};
+
+/*
+ * Hardware performance counters of the calling thread, in user space only.
+ */
+typedef struct BenchCounters {
+  int fds[BENCH_NUM_COUNTERS]; // -1 if the counter is not available
+  double values[BENCH_NUM_COUNTERS]; // scaled for multiplexing, or -1 if not available
+} BenchCounters;
+
+/**
+ * Opens the counters for the calling thread. Counters which the kernel or CPU
+ * does not support are marked as not available.
+ *
+ * @param c  The counters.
+ * @param hitmConfig  The raw event code of HITM loads for this CPU, or 0 to not
+ *                    count them. E.g. 0x04D2 (MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM)
+ *                    on Intel Skylake.
+ */
+static inline void bench_openCounters(BenchCounters *c, uint64_t hitmConfig) {
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    c->fds[i] = -1;
+    c->values[i] = -1.0;
+  }
+#if __linux__
+  static const uint64_t configs[BENCH_LLC_MISSES + 1] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+  };
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (i == BENCH_HITM) {
+      if (hitmConfig == 0) continue;
+      attr.type = PERF_TYPE_RAW;
+      attr.config = hitmConfig;
+    } else {
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+    }
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    c->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#else
+  (void) hitmConfig;
+#endif
+}
+
+static inline void bench_startCounters(BenchCounters *c) {
+#if __linux__
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    if (c->fds[i] < 0) continue;
+    ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+#else
+  (void) c;
+#endif
+}
+
+/**
+ * Stops the counters and reads their values.
+ *
+ * @param c  The counters.
+ */
+static inline void bench_stopCounters(BenchCounters *c) {
+#if __linux__
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    if (c->fds[i] < 0) continue;
+    ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t v[3]; // value, time enabled, time running
+    if ((read(c->fds[i], v, sizeof(v)) == (ssize_t) sizeof(v)) && (v[2] > 0)) {
+      c->values[i] = (double) v[0] * ((double) v[1] / (double) v[2]);
+    } else {
+      c->values[i] = -1.0;
+    }
+  }
+#else
+  (void) c;
+#endif
+}
+
+static inline void bench_closeCounters(BenchCounters *c) {
+#if __linux__
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    if (c->fds[i] >= 0) close(c->fds[i]);
+    c->fds[i] = -1;
+  }
+#else
+  (void) c;
+#endif
+}
+
+#endif // _TPIPE_BENCH_H_
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the throughput of TinyPipe against the reference queues in
+// tpipe_reference.h, with one producer and one consumer thread and the same mix
+// of message sizes. The producer cycles through the given sizes. Each queue is
+// given the same capacity in bytes; slot-based queues size their slots for the
+// largest message.
+//
+// cc -O2 -pthread -I.. tpipe_compare.c ../tinypipe.c -o tpipe_compare
+// ./tpipe_compare [-s message bytes,...] [-p queue bytes] [-n messages]
+//                 [-P producer cpu] [-C consumer cpu]
+
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+#include "tpipe_bench.h"
+#include "tpipe_reference.h"
+
+#define MAX_SIZES 32
+
+typedef enum QueueKind {
+  QUEUE_TINYPIPE,
+  QUEUE_MUTEX,
+  QUEUE_SPSC,
+  QUEUE_MPMC,
+  NUM_QUEUE_KINDS
+} QueueKind;
+
+static const char *const queueNames[NUM_QUEUE_KINDS] = {"tinypipe", "mutex", "spsc", "mpmc"};
+
+typedef struct Config {
+  QueueKind kind;
+  int sizes[MAX_SIZES];
+  int numSizes;
+  int maxBytes;
+  int queueBytes;
+  long messages;
+  int producerCpu;
+  int consumerCpu;
+} Config;
+
+static Config config;
+static TinyPipe pipe_;
+static RefMutexQueue mutexQueue;
+static RefSpscRing spscRing;
+static RefMpmcQueue mpmcQueue;
+
+static void *produce(void *arg) {
+  (void) arg;
+  bench_pinThread(config.producerCpu);
+  char *payload = (char *) malloc(config.maxBytes);
+  assert(payload != NULL);
+  memset(payload, 1, config.maxBytes);
+
+  int spins = 0;
+  for (long i = 0; i < config.messages; ++i) {
+    const int numBytes = config.sizes[i % config.numSizes];
+    switch (config.kind) {
+      case QUEUE_TINYPIPE: {
+        while (!tpipe_write(&pipe_, payload, numBytes)) bench_relax(&spins);
+        break;
+      }
+      case QUEUE_MUTEX: ref_mutexWrite(&mutexQueue, payload, numBytes); break;
+      case QUEUE_SPSC: {
+        while (!ref_spscTryWrite(&spscRing, payload, numBytes)) bench_relax(&spins);
+        break;
+      }
+      case QUEUE_MPMC: {
+        while (!ref_mpmcTryWrite(&mpmcQueue, payload, numBytes)) bench_relax(&spins);
+        break;
+      }
+      default: assert(0);
+    }
+    spins = 0;
+  }
+  free(payload);
+  return NULL;
+}
+
+// Touches every cache line of a message, as a consumer would.
+static inline uint64_t touch(const char *buffer, int len) {
+  uint64_t checksum = 0;
+  for (int j = 0; j < len; j += 64) checksum += (uint8_t) buffer[j];
+  return checksum;
+}
+
+// Runs the producer and consumer over one queue, and prints the results.
+static void run(void) {
+  const int numSlots = config.queueBytes / ref_getSlotBytes(config.maxBytes);
+  switch (config.kind) {
+    case QUEUE_TINYPIPE: tpipe_init(&pipe_, config.queueBytes); break;
+    case QUEUE_MUTEX: ref_mutexInit(&mutexQueue, numSlots, config.maxBytes); break;
+    case QUEUE_SPSC: ref_spscInit(&spscRing, numSlots, config.maxBytes); break;
+    case QUEUE_MPMC: ref_mpmcInit(&mpmcQueue, numSlots, config.maxBytes); break;
+    default: assert(0);
+  }
+  char *scratch = (char *) malloc(config.maxBytes);
+  assert(scratch != NULL);
+
+  pthread_t producer;
+  const double start = bench_getSeconds();
+  pthread_create(&producer, NULL, produce, NULL);
+
+  uint64_t checksum = 0;
+  uint64_t expected = 0;
+  int spins = 0;
+  for (long i = 0; i < config.messages; ++i) {
+    int len = 0;
+    switch (config.kind) {
+      case QUEUE_TINYPIPE: {
+        while (!tpipe_hasData(&pipe_)) bench_relax(&spins);
+        const char *buffer = tpipe_getReadBuffer(&pipe_, &len);
+        checksum += touch(buffer, len);
+        tpipe_consume(&pipe_);
+        break;
+      }
+      case QUEUE_MUTEX: {
+        len = ref_mutexRead(&mutexQueue, scratch);
+        checksum += touch(scratch, len);
+        break;
+      }
+      case QUEUE_SPSC: {
+        const char *buffer;
+        while ((buffer = ref_spscPeek(&spscRing, &len)) == NULL) bench_relax(&spins);
+        checksum += touch(buffer, len);
+        ref_spscConsume(&spscRing);
+        break;
+      }
+      case QUEUE_MPMC: {
+        while ((len = ref_mpmcTryRead(&mpmcQueue, scratch)) < 0) bench_relax(&spins);
+        checksum += touch(scratch, len);
+        break;
+      }
+      default: assert(0);
+    }
+    spins = 0;
+    assert(len == config.sizes[i % config.numSizes]);
+    expected += (len + 63) / 64;
+  }
+  const double elapsed = bench_getSeconds() - start;
+  pthread_join(producer, NULL);
+  assert(checksum == expected);
+
+  long totalBytes = 0;
+  for (long i = 0; i < config.messages; ++i) totalBytes += config.sizes[i % config.numSizes];
+  printf("queue=%s queue_bytes=%d max_message=%d producer_cpu=%d consumer_cpu=%d msgs/s=%.0f GB/s=%.3f\n",
+      queueNames[config.kind], config.queueBytes, config.maxBytes,
+      config.producerCpu, config.consumerCpu,
+      config.messages / elapsed, totalBytes / elapsed / 1e9);
+  fflush(stdout);
+
+  free(scratch);
+  switch (config.kind) {
+    case QUEUE_TINYPIPE: tpipe_free(&pipe_); break;
+    case QUEUE_MUTEX: ref_mutexFree(&mutexQueue); break;
+    case QUEUE_SPSC: ref_spscFree(&spscRing); break;
+    case QUEUE_MPMC: ref_mpmcFree(&mpmcQueue); break;
+    default: assert(0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  config.sizes[0] = 16;
+  config.sizes[1] = 64;
+  config.sizes[2] = 256;
+  config.numSizes = 3;
+  config.queueBytes = 64 * 1024;
+  config.messages = 5000000;
+  config.producerCpu = -1;
+  config.consumerCpu = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:p:n:P:C:")) != -1) {
+    switch (opt) {
+      case 's': config.numSizes = bench_parseList(optarg, config.sizes, MAX_SIZES); break;
+      case 'p': config.queueBytes = atoi(optarg); break;
+      case 'n': config.messages = atol(optarg); break;
+      case 'P': config.producerCpu = atoi(optarg); break;
+      case 'C': config.consumerCpu = atoi(optarg); break;
+      default: fprintf(stderr, "usage: %s [-s bytes,...] [-p bytes] [-n messages] [-P cpu] [-C cpu]\n", argv[0]); return 1;
+    }
+  }
+
+  config.maxBytes = 0;
+  for (int i = 0; i < config.numSizes; ++i) {
+    assert(config.sizes[i] > 0);
+    if (config.sizes[i] > config.maxBytes) config.maxBytes = config.sizes[i];
+  }
+  if ((config.queueBytes / ref_getSlotBytes(config.maxBytes)) < 2) {
+    fprintf(stderr, "the queue must hold at least two of the largest messages\n");
+    return 1;
+  }
+
+  bench_pinThread(config.consumerCpu);
+  for (int k = 0; k < NUM_QUEUE_KINDS; ++k) {
+    config.kind = (QueueKind) k;
+    run();
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the throughput and compression ratio of tpipe_writeCompressed() and
+// tpipe_readCompressed() on text telemetry records, against tpipe_write().
+//
+// cc -O2 -I.. tpipe_compress.c ../tinypipe.c ../tinypipe_lz.c -o tpipe_compress
+// ./tpipe_compress [MB per record size]
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe.h"
+#include "tinypipe_lz.h"
+
+#define PIPE_BYTES (1024 * 1024)
+#define MAX_RECORD_BYTES (16 * 1024)
+
+static double getSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Fills a record with lines of slowly changing sensor readings.
+static void makeRecord(char *record, int numBytes, int seed) {
+  int i = 0;
+  while (i < numBytes) {
+    char line[128];
+    const int len = snprintf(line, sizeof(line),
+        "t=%d sensor=%d temp=%d.%d rpm=%d status=OK\n",
+        1000000 + seed, seed & 0x7, 20 + ((seed >> 4) & 0x3), seed & 0x9, 3000 + (seed & 0x3F));
+    const int n = ((numBytes - i) < len) ? (numBytes - i) : len;
+    memcpy(record + i, line, n);
+    i += n;
+    ++seed;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const long totalBytes = ((argc > 1) ? atol(argv[1]) : 64) * 1024 * 1024;
+  char *record = (char *) malloc(MAX_RECORD_BYTES);
+  char *output = (char *) malloc(MAX_RECORD_BYTES);
+  assert(record != NULL && output != NULL);
+
+  TinyPipe pipe;
+  tpipe_init(&pipe, PIPE_BYTES);
+
+  printf("%8s %12s %12s %8s\n", "bytes", "plain MB/s", "lz MB/s", "ratio");
+  for (int numBytes = 64; numBytes <= MAX_RECORD_BYTES; numBytes *= 4) {
+    makeRecord(record, numBytes, numBytes);
+    const long records = totalBytes / numBytes;
+
+    double t = getSeconds();
+    for (long i = 0; i < records; ++i) {
+      const int success = tpipe_write(&pipe, record, numBytes);
+      assert(success);
+      int len = 0;
+      tpipe_hasData(&pipe);
+      memcpy(output, tpipe_getReadBuffer(&pipe, &len), len);
+      tpipe_consume(&pipe);
+    }
+    const double plainSeconds = getSeconds() - t;
+
+    long pipeBytes = 0;
+    t = getSeconds();
+    for (long i = 0; i < records; ++i) {
+      const int success = tpipe_writeCompressed(&pipe, record, numBytes);
+      assert(success);
+      int len = 0;
+      tpipe_hasData(&pipe);
+      tpipe_getReadBuffer(&pipe, &len);
+      pipeBytes += len;
+      const int outputBytes = tpipe_readCompressed(&pipe, output, MAX_RECORD_BYTES);
+      assert(outputBytes == numBytes);
+      tpipe_consume(&pipe);
+    }
+    const double lzSeconds = getSeconds() - t;
+    assert(memcmp(record, output, numBytes) == 0);
+
+    printf("%8d %12.1f %12.1f %8.2f\n", numBytes,
+        totalBytes / plainSeconds / 1e6, totalBytes / lzSeconds / 1e6,
+        (double) records * numBytes / pipeBytes);
+  }
+
+  tpipe_free(&pipe);
+  free(output);
+  free(record);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the copy in tpipe_write() for payloads from 16B to 1MB. Between writes
+// the producer cycles through a working set of its own, which suffers if the copy
+// evicts it from the cache. Build with -DTPIPE_STREAMING_COPY_BYTES=0x7FFFFFFF to
+// compare against a plain memcpy().
+//
+// cc -O2 -I.. tpipe_copy.c ../tinypipe.c -o tpipe_copy
+// ./tpipe_copy [MB per payload size] [working set KB]
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe.h"
+
+#define PIPE_BYTES (8 * 1024 * 1024)
+#define MAX_PAYLOAD_BYTES (1024 * 1024)
+
+static double getSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  const long totalBytes = ((argc > 1) ? atol(argv[1]) : 256) * 1024 * 1024;
+  const int workingSetBytes = ((argc > 2) ? atoi(argv[2]) : 256) * 1024;
+
+  char *payload = (char *) malloc(MAX_PAYLOAD_BYTES);
+  char *workingSet = (char *) malloc(workingSetBytes);
+  assert(payload != NULL && workingSet != NULL);
+  memset(payload, 0xA5, MAX_PAYLOAD_BYTES);
+  memset(workingSet, 0, workingSetBytes);
+
+  TinyPipe pipe;
+  tpipe_init(&pipe, PIPE_BYTES);
+
+  printf("%10s %12s %12s %12s\n", "bytes", "ns/write", "GB/s", "ns/work");
+  for (int numBytes = 16; numBytes <= MAX_PAYLOAD_BYTES; numBytes *= 4) {
+    const long writes = totalBytes / numBytes;
+    double copySeconds = 0.0;
+    double touchSeconds = 0.0;
+    uint32_t checksum = 0;
+    int line = 0;
+    for (long i = 0; i < writes; ++i) {
+      double t = getSeconds();
+      const int success = tpipe_write(&pipe, payload, numBytes);
+      assert(success);
+      copySeconds += getSeconds() - t;
+
+      // the producer's own work, one cache line for each line of payload
+      t = getSeconds();
+      for (int j = 0; j < numBytes; j += 64) {
+        checksum += (uint8_t) workingSet[line]++;
+        line = (line + 64) % workingSetBytes;
+      }
+      touchSeconds += getSeconds() - t;
+
+      while (tpipe_hasData(&pipe)) tpipe_consume(&pipe);
+    }
+    printf("%10d %12.1f %12.2f %12.1f\n", numBytes, 1e9 * copySeconds / writes,
+        (double) writes * numBytes / copySeconds / 1e9, 1e9 * touchSeconds / writes);
+    if (checksum == 1) printf("\n"); // keep the working set alive
+  }
+
+  tpipe_free(&pipe);
+  free(workingSet);
+  free(payload);
+  return 0;
+}
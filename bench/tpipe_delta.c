@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the throughput and bytes per record of tpipe_writeDelta() and
+// tpipe_readDelta() on streams of metering records, against tpipe_write(). The
+// readings of one stream are quantised in steps of a power of two, as by an ADC,
+// and those of the other vary continuously.
+//
+// cc -O2 -I.. tpipe_delta.c ../tinypipe.c ../tinypipe_delta.c -o tpipe_delta
+// ./tpipe_delta [millions of records]
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe.h"
+#include "tinypipe_delta.h"
+
+#define PIPE_BYTES (1024 * 1024)
+
+typedef struct MeterRecord {
+  uint32_t sequence;
+  uint32_t timestamp; // milliseconds
+  int32_t energy; // watt hours, increasing
+  int32_t status;
+  float voltage[3];
+  float current[3];
+  float frequency;
+  float powerFactor;
+} MeterRecord;
+
+#define METER_LAYOUT "iiiiffffffff"
+
+static double getSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Returns a random value in [-1, 1].
+static float getNoise(void) {
+  return ((float) rand() / (float) RAND_MAX) * 2.0f - 1.0f;
+}
+
+// Advances a record by one reading of slowly changing values.
+static void nextRecord(MeterRecord *r, int quantised) {
+  r->sequence += 1;
+  r->timestamp += 100;
+  r->energy += rand() % 4;
+  for (int i = 0; i < 3; ++i) {
+    if (quantised) {
+      r->voltage[i] = 230.0f + (float) ((rand() % 8) - 4) * 0.125f;
+      r->current[i] = 12.0f + (float) (rand() % 4) * 0.25f;
+    } else {
+      r->voltage[i] = 230.0f + 0.05f * getNoise();
+      r->current[i] = 12.0f + 0.5f * getNoise();
+    }
+  }
+  if ((rand() % 16) == 0) {
+    r->frequency = quantised
+        ? (50.0f + (float) ((rand() % 4) - 2) * 0.0625f)
+        : (50.0f + 0.1f * getNoise());
+  }
+}
+
+static void runStream(const char *name, int quantised, long numRecords) {
+  const int numBytes = (int) sizeof(MeterRecord);
+
+  MeterRecord *records = (MeterRecord *) malloc(4096 * sizeof(MeterRecord));
+  assert(records != NULL);
+  MeterRecord r = {0, 0, 0, 0, {230.0f, 230.0f, 230.0f}, {12.0f, 12.0f, 12.0f}, 50.0f, 0.95f};
+  for (int i = 0; i < 4096; ++i) {
+    nextRecord(&r, quantised);
+    records[i] = r;
+  }
+
+  TinyPipe pipe;
+  tpipe_init(&pipe, PIPE_BYTES);
+  MeterRecord output;
+
+  double t = getSeconds();
+  for (long i = 0; i < numRecords; ++i) {
+    const int success = tpipe_write(&pipe, (char *) (records + (i & 4095)), numBytes);
+    assert(success);
+    int len = 0;
+    tpipe_hasData(&pipe);
+    memcpy(&output, tpipe_getReadBuffer(&pipe, &len), len);
+    tpipe_consume(&pipe);
+  }
+  const double plainSeconds = getSeconds() - t;
+
+  TinyPipeDelta encoder, decoder;
+  const int layoutBytes = tpipe_deltaInit(&encoder, METER_LAYOUT);
+  tpipe_deltaInit(&decoder, METER_LAYOUT);
+  assert(layoutBytes == numBytes);
+
+  long pipeBytes = 0;
+  t = getSeconds();
+  for (long i = 0; i < numRecords; ++i) {
+    const int success = tpipe_writeDelta(&pipe, &encoder, (const char *) (records + (i & 4095)));
+    assert(success);
+    int len = 0;
+    tpipe_hasData(&pipe);
+    tpipe_getReadBuffer(&pipe, &len);
+    pipeBytes += len;
+    const int decoded = tpipe_readDelta(&pipe, &decoder, (char *) &output);
+    assert(decoded);
+    tpipe_consume(&pipe);
+  }
+  const double deltaSeconds = getSeconds() - t;
+  assert(memcmp(records + ((numRecords - 1) & 4095), &output, numBytes) == 0);
+
+  printf("%12s %8d %12.1f %12.1f %14.2f\n", name, numBytes,
+      1e9 * plainSeconds / numRecords, 1e9 * deltaSeconds / numRecords,
+      (double) pipeBytes / numRecords);
+
+  tpipe_deltaFree(&decoder);
+  tpipe_deltaFree(&encoder);
+  tpipe_free(&pipe);
+  free(records);
+}
+
+int main(int argc, char *argv[]) {
+  const long numRecords = ((argc > 1) ? atol(argv[1]) : 8) * 1000000;
+  printf("%12s %8s %12s %12s %14s\n", "stream", "bytes", "plain ns", "delta ns", "delta bytes");
+  runStream("quantised", 1, numRecords);
+  runStream("continuous", 0, numRecords);
+  return 0;
+}
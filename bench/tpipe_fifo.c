@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the pipe as a single-threaded FIFO of variable-length commands. Build
+// it twice to compare the default and fence-free modes.
+//
+// cc -O2 -I.. tpipe_fifo.c ../tinypipe.c -o tpipe_fifo
+// cc -O2 -I.. -DTPIPE_SINGLE_THREADED=1 tpipe_fifo.c ../tinypipe.c -o tpipe_fifo_st
+// ./tpipe_fifo [iterations]
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe.h"
+
+#define PIPE_BYTES (64 * 1024)
+#define COMMANDS_PER_FRAME 256
+
+static double getSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+  char command[64];
+  memset(command, 0, sizeof(command));
+
+  TinyPipe pipe;
+  tpipe_init(&pipe, PIPE_BYTES);
+
+  uint32_t checksum = 0;
+  const double start = getSeconds();
+  for (int i = 0; i < iterations; ++i) {
+    // defer a frame's worth of commands of varying length
+    for (int j = 0; j < COMMANDS_PER_FRAME; ++j) {
+      const int len = 8 + ((i + j) & 0x1F);
+      char *buffer = tpipe_getWriteBuffer(&pipe, len);
+      assert(buffer != NULL);
+      memcpy(buffer, command, len);
+      buffer[0] = (char) j;
+      tpipe_produce(&pipe, len);
+    }
+
+    // then execute them
+    while (tpipe_hasData(&pipe)) {
+      int len = 0;
+      char *buffer = tpipe_getReadBuffer(&pipe, &len);
+      checksum += (uint8_t) buffer[0] + len;
+      tpipe_consume(&pipe);
+    }
+  }
+  const double elapsed = getSeconds() - start;
+
+  const double messages = (double) iterations * COMMANDS_PER_FRAME;
+  printf("single_threaded=%d messages=%.0f ns/message=%.2f checksum=%u\n",
+      TPIPE_SINGLE_THREADED, messages, 1e9 * elapsed / messages, checksum);
+  tpipe_free(&pipe);
+  return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures hardware performance counters per message of a producer and a
+// consumer thread, each pinned to a chosen CPU, for every combination of payload
+// size and pipe size. Counters are read with perf_event_open() for user space
+// only, and are reported as n/a where the kernel or CPU does not provide them
+// (e.g. kernel.perf_event_paranoid > 2, or in a virtual machine). HITM loads are
+// only counted if their raw event code for this CPU is given.
+//
+// cc -O2 -pthread -I.. tpipe_perf.c ../tinypipe.c -o tpipe_perf
+// ./tpipe_perf [-s payload bytes,...] [-p pipe bytes,...] [-n messages]
+//              [-P producer cpu] [-C consumer cpu] [-H raw hitm event]
+
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+#include "tpipe_bench.h"
+
+#define MAX_SIZES 32
+#define MAX_BYTES_PER_RUN (4LL * 1024 * 1024 * 1024)
+
+typedef struct Config {
+  int payloadBytes;
+  int pipeBytes;
+  long messages;
+  int producerCpu;
+  int consumerCpu;
+  uint64_t hitmConfig;
+} Config;
+
+static TinyPipe pipe_;
+static Config config;
+static BenchCounters producerCounters;
+
+static void *produce(void *arg) {
+  (void) arg;
+  bench_pinThread(config.producerCpu);
+  char *payload = (char *) malloc(config.payloadBytes);
+  assert(payload != NULL);
+  memset(payload, 1, config.payloadBytes);
+
+  bench_openCounters(&producerCounters, config.hitmConfig);
+  bench_startCounters(&producerCounters);
+  int spins = 0;
+  for (long i = 0; i < config.messages; ++i) {
+    while (!tpipe_write(&pipe_, payload, config.payloadBytes)) bench_relax(&spins);
+    spins = 0;
+  }
+  bench_stopCounters(&producerCounters);
+  bench_closeCounters(&producerCounters);
+  free(payload);
+  return NULL;
+}
+
+static void printCounters(const char *prefix, const BenchCounters *c, long messages) {
+  for (int i = 0; i < BENCH_NUM_COUNTERS; ++i) {
+    if (c->values[i] < 0.0) printf(" %s_%s/msg=n/a", prefix, bench_counterNames[i]);
+    else printf(" %s_%s/msg=%.3f", prefix, bench_counterNames[i], c->values[i] / messages);
+  }
+  if ((c->values[BENCH_CYCLES] > 0.0) && (c->values[BENCH_INSTRUCTIONS] >= 0.0)) {
+    printf(" %s_ipc=%.3f", prefix, c->values[BENCH_INSTRUCTIONS] / c->values[BENCH_CYCLES]);
+  } else {
+    printf(" %s_ipc=n/a", prefix);
+  }
+}
+
+// Runs the producer and consumer over one combination of payload and pipe size.
+static void run(void) {
+  tpipe_init(&pipe_, config.pipeBytes);
+
+  BenchCounters consumerCounters;
+  bench_openCounters(&consumerCounters, config.hitmConfig);
+
+  pthread_t producer;
+  const double start = bench_getSeconds();
+  pthread_create(&producer, NULL, produce, NULL);
+
+  // consume, touching every cache line of the payload
+  bench_startCounters(&consumerCounters);
+  uint64_t checksum = 0;
+  int spins = 0;
+  for (long i = 0; i < config.messages; ++i) {
+    while (!tpipe_hasData(&pipe_)) bench_relax(&spins);
+    spins = 0;
+    int len = 0;
+    const char *buffer = tpipe_getReadBuffer(&pipe_, &len);
+    for (int j = 0; j < len; j += 64) checksum += (uint8_t) buffer[j];
+    tpipe_consume(&pipe_);
+  }
+  bench_stopCounters(&consumerCounters);
+  const double elapsed = bench_getSeconds() - start;
+  pthread_join(producer, NULL);
+  bench_closeCounters(&consumerCounters);
+  assert(checksum == (uint64_t) config.messages * ((config.payloadBytes + 63) / 64));
+
+  printf("payload=%d pipe=%d producer_cpu=%d consumer_cpu=%d msgs=%ld ns/msg=%.2f",
+      config.payloadBytes, config.pipeBytes, config.producerCpu, config.consumerCpu,
+      config.messages, 1e9 * elapsed / config.messages);
+  printCounters("p", &producerCounters, config.messages);
+  printCounters("c", &consumerCounters, config.messages);
+  printf("\n");
+  fflush(stdout);
+  tpipe_free(&pipe_);
+}
+
+int main(int argc, char *argv[]) {
+  int payloadSizes[MAX_SIZES] = {8, 64, 512, 4096, 65536};
+  int numPayloadSizes = 5;
+  int pipeSizes[MAX_SIZES] = {16 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024};
+  int numPipeSizes = 4;
+  long messages = 2000000;
+  config.producerCpu = -1;
+  config.consumerCpu = -1;
+  config.hitmConfig = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:p:n:P:C:H:")) != -1) {
+    switch (opt) {
+      case 's': numPayloadSizes = bench_parseList(optarg, payloadSizes, MAX_SIZES); break;
+      case 'p': numPipeSizes = bench_parseList(optarg, pipeSizes, MAX_SIZES); break;
+      case 'n': messages = atol(optarg); break;
+      case 'P': config.producerCpu = atoi(optarg); break;
+      case 'C': config.consumerCpu = atoi(optarg); break;
+      case 'H': config.hitmConfig = strtoull(optarg, NULL, 0); break;
+      default: fprintf(stderr, "usage: %s [-s bytes,...] [-p bytes,...] [-n messages] [-P cpu] [-C cpu] [-H event]\n", argv[0]); return 1;
+    }
+  }
+
+  bench_pinThread(config.consumerCpu);
+  for (int i = 0; i < numPayloadSizes; ++i) {
+    for (int j = 0; j < numPipeSizes; ++j) {
+      config.payloadBytes = payloadSizes[i];
+      config.pipeBytes = pipeSizes[j];
+      if ((2 * config.payloadBytes) > config.pipeBytes) continue; // too few messages fit
+
+      // limit the bytes moved by runs with large payloads
+      config.messages = messages;
+      if (((long long) config.messages * config.payloadBytes) > MAX_BYTES_PER_RUN) {
+        config.messages = (long) (MAX_BYTES_PER_RUN / config.payloadBytes);
+      }
+      run();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the round trip time of a message sent through one pipe and echoed back
+// through another, and reports its distribution. The receiving thread either
+// busy-polls the pipe or sleeps on a futex which the sender wakes. Round trips are
+// timed with the TSC on x86.
+//
+// cc -O2 -pthread -I.. tpipe_pingpong.c ../tinypipe.c ../tinypipe_histogram.c -lm -o tpipe_pingpong
+// ./tpipe_pingpong [-w spin|futex] [-s payload bytes] [-n round trips]
+//                  [-P ping cpu] [-C echo cpu]
+
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if __linux__
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+#endif
+
+#include "tinypipe.h"
+#include "tinypipe_histogram.h"
+#include "tpipe_bench.h"
+
+#define PIPE_BYTES (64 * 1024)
+#define WARMUP_ROUND_TRIPS 10000
+
+/*
+ * A pipe which a sleeping consumer can wait on.
+ */
+typedef struct Channel {
+  TinyPipe pipe;
+  uint32_t sequence; // incremented after each message, the futex word
+  uint32_t waiting; // set while the consumer may be sleeping
+} Channel;
+
+typedef struct Config {
+  int useFutex;
+  int payloadBytes;
+  long roundTrips;
+  int pingCpu;
+  int echoCpu;
+} Config;
+
+static Channel ping;
+static Channel pong;
+static Config config;
+static TinyPipeHistogram roundTripNanoseconds;
+
+static void channel_send(Channel *c, char *payload) {
+  int spins = 0;
+  while (!tpipe_write(&c->pipe, payload, config.payloadBytes)) bench_relax(&spins);
+#if __linux__
+  if (config.useFutex) {
+    // the consumer either sees the new sequence before sleeping, or is woken
+    __atomic_fetch_add(&c->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->waiting, __ATOMIC_SEQ_CST)) {
+      syscall(SYS_futex, &c->sequence, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+  }
+#endif
+}
+
+// Waits until the channel has data, and returns its read buffer.
+static char *channel_receive(Channel *c) {
+  int spins = 0;
+  while (!tpipe_hasData(&c->pipe)) {
+#if __linux__
+    if (config.useFutex) {
+      __atomic_store_n(&c->waiting, 1, __ATOMIC_SEQ_CST);
+      const uint32_t sequence = __atomic_load_n(&c->sequence, __ATOMIC_SEQ_CST);
+      if (!tpipe_hasData(&c->pipe)) {
+        syscall(SYS_futex, &c->sequence, FUTEX_WAIT_PRIVATE, sequence, NULL, NULL, 0);
+      }
+      __atomic_store_n(&c->waiting, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+#endif
+    bench_relax(&spins);
+  }
+  int len = 0;
+  return tpipe_getReadBuffer(&c->pipe, &len);
+}
+
+static void *echo(void *arg) {
+  (void) arg;
+  bench_pinThread(config.echoCpu);
+  char *payload = (char *) malloc(config.payloadBytes);
+  assert(payload != NULL);
+  for (long i = 0; i < (WARMUP_ROUND_TRIPS + config.roundTrips); ++i) {
+    memcpy(payload, channel_receive(&ping), config.payloadBytes);
+    tpipe_consume(&ping.pipe);
+    channel_send(&pong, payload);
+  }
+  free(payload);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  config.useFutex = 0;
+  config.payloadBytes = 64;
+  config.roundTrips = 1000000;
+  config.pingCpu = -1;
+  config.echoCpu = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "w:s:n:P:C:")) != -1) {
+    switch (opt) {
+      case 'w': config.useFutex = (strcmp(optarg, "futex") == 0); break;
+      case 's': config.payloadBytes = atoi(optarg); break;
+      case 'n': config.roundTrips = atol(optarg); break;
+      case 'P': config.pingCpu = atoi(optarg); break;
+      case 'C': config.echoCpu = atoi(optarg); break;
+      default: fprintf(stderr, "usage: %s [-w spin|futex] [-s bytes] [-n round trips] [-P cpu] [-C cpu]\n", argv[0]); return 1;
+    }
+  }
+#if !__linux__
+  config.useFutex = 0;
+#endif
+  if (config.payloadBytes < (int) sizeof(long)) config.payloadBytes = (int) sizeof(long);
+
+  const double ticksPerNanosecond = bench_getTicksPerSecond() / 1e9;
+  tpipe_init(&ping.pipe, PIPE_BYTES);
+  tpipe_init(&pong.pipe, PIPE_BYTES);
+  tpipe_histogramClear(&roundTripNanoseconds);
+  bench_pinThread(config.pingCpu);
+
+  char *payload = (char *) malloc(config.payloadBytes);
+  assert(payload != NULL);
+  memset(payload, 0, config.payloadBytes);
+
+  pthread_t echoThread;
+  pthread_create(&echoThread, NULL, echo, NULL);
+
+  double sum = 0.0;
+  double sumOfSquares = 0.0;
+  for (long i = 0; i < (WARMUP_ROUND_TRIPS + config.roundTrips); ++i) {
+    memcpy(payload, &i, sizeof(i));
+    const uint64_t start = bench_getTicks();
+    channel_send(&ping, payload);
+    const char *reply = channel_receive(&pong);
+    const uint64_t end = bench_getTicks();
+    long j;
+    memcpy(&j, reply, sizeof(j));
+    assert(j == i);
+    tpipe_consume(&pong.pipe);
+
+    if (i >= WARMUP_ROUND_TRIPS) {
+      const double nanoseconds = (double) (end - start) / ticksPerNanosecond;
+      tpipe_histogramRecord(&roundTripNanoseconds, (uint64_t) nanoseconds);
+      sum += nanoseconds;
+      sumOfSquares += nanoseconds * nanoseconds;
+    }
+  }
+  pthread_join(echoThread, NULL);
+
+  const double mean = sum / config.roundTrips;
+  const double jitter = sqrt(fmax(0.0, (sumOfSquares / config.roundTrips) - (mean * mean)));
+  const TinyPipeHistogram *const h = &roundTripNanoseconds;
+  printf("wait=%s payload=%d ping_cpu=%d echo_cpu=%d round_trips=%ld "
+      "mean_ns=%.1f p50_ns=%llu p99_ns=%llu p99.9_ns=%llu max_ns=%llu jitter_ns=%.1f\n",
+      config.useFutex ? "futex" : "spin", config.payloadBytes, config.pingCpu, config.echoCpu,
+      config.roundTrips, mean,
+      (unsigned long long) tpipe_histogramGetPercentile(h, 50.0),
+      (unsigned long long) tpipe_histogramGetPercentile(h, 99.0),
+      (unsigned long long) tpipe_histogramGetPercentile(h, 99.9),
+      (unsigned long long) tpipe_histogramGetPercentile(h, 100.0),
+      jitter);
+
+  free(payload);
+  tpipe_free(&pong.pipe);
+  tpipe_free(&ping.pipe);
+  return 0;
+}
@@ -0,0 +1,261 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Small reference queues which the benchmarks compare TinyPipe against. Each
+// stores messages of up to a maximum length in fixed-size slots, each holding an
+// int32 length followed by the message. These are for benchmarking only.
+
+#ifndef _TPIPE_REFERENCE_H_
+#define _TPIPE_REFERENCE_H_
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REF_CACHE_LINE 64
+
+// Returns the size of a slot holding messages of up to maxMessageBytes, rounded up
+// to a multiple of 8 bytes.
+static inline int ref_getSlotBytes(int maxMessageBytes) {
+  return (int) ((sizeof(int32_t) + maxMessageBytes + 7) & ~7);
+}
+
+static inline char *ref_allocSlots(int numSlots, int slotBytes) {
+  char *slots = NULL;
+  const int result = posix_memalign((void **) &slots, REF_CACHE_LINE, (size_t) numSlots * slotBytes);
+  assert(result == 0);
+  (void) result;
+  return slots;
+}
+
+/*
+ * A ring of slots guarded by a mutex, with condition variables to wait for space
+ * and for messages.
+ */
+typedef struct RefMutexQueue {
+  pthread_mutex_t mutex;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  char *slots;
+  int slotBytes;
+  int numSlots;
+  int head; // the next slot to read
+  int count; // the number of slots in use
+} RefMutexQueue;
+
+static inline void ref_mutexInit(RefMutexQueue *q, int numSlots, int maxMessageBytes) {
+  pthread_mutex_init(&q->mutex, NULL);
+  pthread_cond_init(&q->notEmpty, NULL);
+  pthread_cond_init(&q->notFull, NULL);
+  q->slotBytes = ref_getSlotBytes(maxMessageBytes);
+  q->numSlots = numSlots;
+  q->slots = ref_allocSlots(numSlots, q->slotBytes);
+  q->head = 0;
+  q->count = 0;
+}
+
+static inline void ref_mutexFree(RefMutexQueue *q) {
+  free(q->slots);
+  pthread_cond_destroy(&q->notFull);
+  pthread_cond_destroy(&q->notEmpty);
+  pthread_mutex_destroy(&q->mutex);
+}
+
+// Writes a message, waiting for space.
+static inline void ref_mutexWrite(RefMutexQueue *q, const char *data, int numBytes) {
+  pthread_mutex_lock(&q->mutex);
+  while (q->count == q->numSlots) pthread_cond_wait(&q->notFull, &q->mutex);
+  char *const slot = q->slots + (size_t) ((q->head + q->count) % q->numSlots) * q->slotBytes;
+  const int32_t len = numBytes;
+  memcpy(slot, &len, sizeof(len));
+  memcpy(slot + sizeof(int32_t), data, numBytes);
+  q->count++;
+  pthread_cond_signal(&q->notEmpty);
+  pthread_mutex_unlock(&q->mutex);
+}
+
+// Reads a message into the given buffer, waiting for one. Returns its length.
+static inline int ref_mutexRead(RefMutexQueue *q, char *data) {
+  pthread_mutex_lock(&q->mutex);
+  while (q->count == 0) pthread_cond_wait(&q->notEmpty, &q->mutex);
+  const char *const slot = q->slots + (size_t) q->head * q->slotBytes;
+  int32_t len;
+  memcpy(&len, slot, sizeof(len));
+  memcpy(data, slot + sizeof(int32_t), len);
+  q->head = (q->head + 1) % q->numSlots;
+  q->count--;
+  pthread_cond_signal(&q->notFull);
+  pthread_mutex_unlock(&q->mutex);
+  return len;
+}
+
+/*
+ * A single-producer single-consumer ring of slots. Each side keeps a cached copy
+ * of the other side's index, and only reloads it when the ring appears full or
+ * empty. Messages are read in place.
+ */
+typedef struct RefSpscRing {
+  char *slots;
+  int slotBytes;
+  uint32_t mask; // the number of slots minus one
+  char pad0[REF_CACHE_LINE];
+  uint32_t tail; // written by the producer
+  uint32_t cachedHead;
+  char pad1[REF_CACHE_LINE];
+  uint32_t head; // written by the consumer
+  uint32_t cachedTail;
+  char pad2[REF_CACHE_LINE];
+} RefSpscRing;
+
+// The number of slots is rounded down to a power of two.
+static inline void ref_spscInit(RefSpscRing *q, int numSlots, int maxMessageBytes) {
+  uint32_t n = 1;
+  while ((int) (2 * n) <= numSlots) n *= 2;
+  q->slotBytes = ref_getSlotBytes(maxMessageBytes);
+  q->mask = n - 1;
+  q->slots = ref_allocSlots((int) n, q->slotBytes);
+  q->tail = 0;
+  q->cachedHead = 0;
+  q->head = 0;
+  q->cachedTail = 0;
+}
+
+static inline void ref_spscFree(RefSpscRing *q) {
+  free(q->slots);
+}
+
+// Returns 1 if the message was written, 0 if the ring is full.
+static inline int ref_spscTryWrite(RefSpscRing *q, const char *data, int numBytes) {
+  const uint32_t tail = q->tail;
+  if ((tail - q->cachedHead) > q->mask) {
+    q->cachedHead = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if ((tail - q->cachedHead) > q->mask) return 0;
+  }
+  char *const slot = q->slots + (size_t) (tail & q->mask) * q->slotBytes;
+  const int32_t len = numBytes;
+  memcpy(slot, &len, sizeof(len));
+  memcpy(slot + sizeof(int32_t), data, numBytes);
+  __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Returns the next message in place, or NULL if the ring is empty.
+static inline const char *ref_spscPeek(RefSpscRing *q, int *numBytes) {
+  const uint32_t head = q->head;
+  if (head == q->cachedTail) {
+    q->cachedTail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head == q->cachedTail) return NULL;
+  }
+  const char *const slot = q->slots + (size_t) (head & q->mask) * q->slotBytes;
+  int32_t len;
+  memcpy(&len, slot, sizeof(len));
+  *numBytes = len;
+  return slot + sizeof(int32_t);
+}
+
+// Releases the message returned by ref_spscPeek().
+static inline void ref_spscConsume(RefSpscRing *q) {
+  __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Dmitry Vyukov's bounded multi-producer multi-consumer queue. Each slot has a
+ * sequence number which tells producers and consumers whether it is free for
+ * the current lap.
+ */
+typedef struct RefMpmcQueue {
+  char *slots; // each slot starts with its sequence number
+  int slotBytes;
+  uint64_t mask;
+  char pad0[REF_CACHE_LINE];
+  uint64_t enqueuePosition;
+  char pad1[REF_CACHE_LINE];
+  uint64_t dequeuePosition;
+  char pad2[REF_CACHE_LINE];
+} RefMpmcQueue;
+
+static inline uint64_t *ref_mpmcGetSequence(RefMpmcQueue *q, uint64_t position) {
+  return (uint64_t *) (q->slots + (size_t) (position & q->mask) * q->slotBytes);
+}
+
+// The number of slots is rounded down to a power of two.
+static inline void ref_mpmcInit(RefMpmcQueue *q, int numSlots, int maxMessageBytes) {
+  uint64_t n = 1;
+  while ((int) (2 * n) <= numSlots) n *= 2;
+  q->slotBytes = (int) sizeof(uint64_t) + ref_getSlotBytes(maxMessageBytes);
+  q->mask = n - 1;
+  q->slots = ref_allocSlots((int) n, q->slotBytes);
+  for (uint64_t i = 0; i < n; ++i) *ref_mpmcGetSequence(q, i) = i;
+  q->enqueuePosition = 0;
+  q->dequeuePosition = 0;
+}
+
+static inline void ref_mpmcFree(RefMpmcQueue *q) {
+  free(q->slots);
+}
+
+// Returns 1 if the message was written, 0 if the queue is full.
+static inline int ref_mpmcTryWrite(RefMpmcQueue *q, const char *data, int numBytes) {
+  uint64_t position = __atomic_load_n(&q->enqueuePosition, __ATOMIC_RELAXED);
+  uint64_t *sequence;
+  for (;;) {
+    sequence = ref_mpmcGetSequence(q, position);
+    const int64_t d = (int64_t) (__atomic_load_n(sequence, __ATOMIC_ACQUIRE) - position);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&q->enqueuePosition, &position, position + 1, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (d < 0) {
+      return 0; // full
+    } else {
+      position = __atomic_load_n(&q->enqueuePosition, __ATOMIC_RELAXED);
+    }
+  }
+  char *const slot = (char *) (sequence + 1);
+  const int32_t len = numBytes;
+  memcpy(slot, &len, sizeof(len));
+  memcpy(slot + sizeof(int32_t), data, numBytes);
+  __atomic_store_n(sequence, position + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Reads a message into the given buffer. Returns its length, or -1 if the queue
+// is empty.
+static inline int ref_mpmcTryRead(RefMpmcQueue *q, char *data) {
+  uint64_t position = __atomic_load_n(&q->dequeuePosition, __ATOMIC_RELAXED);
+  uint64_t *sequence;
+  for (;;) {
+    sequence = ref_mpmcGetSequence(q, position);
+    const int64_t d = (int64_t) (__atomic_load_n(sequence, __ATOMIC_ACQUIRE) - (position + 1));
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeuePosition, &position, position + 1, 1,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (d < 0) {
+      return -1; // empty
+    } else {
+      position = __atomic_load_n(&q->dequeuePosition, __ATOMIC_RELAXED);
+    }
+  }
+  const char *const slot = (const char *) (sequence + 1);
+  int32_t len;
+  memcpy(&len, slot, sizeof(len));
+  memcpy(data, slot + sizeof(int32_t), len);
+  __atomic_store_n(sequence, position + q->mask + 1, __ATOMIC_RELEASE);
+  return len;
+}
+
+#endif // _TPIPE_REFERENCE_H_
@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the resident set size of a large pipe after a burst has been drained,
+// with and without idle memory release.
+//
+// cc -O2 -I.. tpipe_rss.c ../tinypipe.c -o tpipe_rss
+// ./tpipe_rss [pipe MB] [burst MB] [release KB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+
+#define RECORD_BYTES 4096
+
+// Returns the resident set size of this process in KB.
+static long getRssKb(void) {
+  long size = 0;
+  long resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) return -1;
+  if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = -1;
+  fclose(f);
+  return (resident < 0) ? -1 : (resident * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+static void run(int pipeBytes, int burstBytes, int releaseBytes) {
+  char record[RECORD_BYTES];
+  memset(record, 0x5A, sizeof(record));
+
+  const long rssStart = getRssKb();
+  TinyPipe pipe;
+  tpipe_init(&pipe, pipeBytes);
+  tpipe_setIdleRelease(&pipe, releaseBytes);
+
+  // burst
+  for (int i = 0; i < burstBytes; i += RECORD_BYTES) {
+    if (!tpipe_write(&pipe, record, RECORD_BYTES)) break;
+  }
+  const long rssBurst = getRssKb();
+
+  // drain
+  while (tpipe_hasData(&pipe)) tpipe_consume(&pipe);
+  const long rssIdle = getRssKb();
+
+  printf("%10d %10ld %10ld %10ld\n",
+      releaseBytes / 1024, rssStart, rssBurst, rssIdle);
+  tpipe_free(&pipe);
+}
+
+int main(int argc, char *argv[]) {
+  const int pipeBytes = ((argc > 1) ? atoi(argv[1]) : 64) * 1024 * 1024;
+  const int burstBytes = ((argc > 2) ? atoi(argv[2]) : 50) * 1024 * 1024;
+  const int releaseBytes = ((argc > 3) ? atoi(argv[3]) : 1024) * 1024;
+
+  printf("%10s %10s %10s %10s\n", "release KB", "start KB", "burst KB", "idle KB");
+  run(pipeBytes, burstBytes, 0);
+  run(pipeBytes, burstBytes, releaseBytes);
+  return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Measures the throughput of a producer and a consumer thread for every
+// combination of write mode, payload size, pipe size and thread placement, and
+// prints one line of results per combination.
+//
+// Write modes are "write", which copies a prepared payload with tpipe_write(),
+// and "reserve", which fills the payload in place between tpipe_getWriteBuffer()
+// and tpipe_produce(). Placements are "smt" (SMT siblings of one core), "core"
+// (different cores of one socket) and "socket" (different sockets), found from
+// the CPU topology, or explicit CPUs given with -P and -C. Threads are not pinned
+// by default. Build with -DTPIPE_PREFETCH_DISTANCE=0 to compare against no
+// prefetching.
+//
+// cc -O2 -pthread -I.. tpipe_throughput.c ../tinypipe.c -o tpipe_throughput
+// ./tpipe_throughput [-m write,reserve] [-s payload bytes,...] [-p pipe bytes,...]
+//                    [-L smt,core,socket] [-P producer cpu] [-C consumer cpu]
+//                    [-n messages] [-c]
+//
+// -c prints CSV instead of key=value pairs.
+
+#define _GNU_SOURCE // for pthread_setaffinity_np()
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+#include "tpipe_bench.h"
+
+#define MAX_VALUES 32
+#define MAX_BYTES_PER_RUN (1024LL * 1024 * 1024)
+
+typedef enum WriteMode {
+  WRITE_MODE_WRITE,
+  WRITE_MODE_RESERVE,
+  NUM_WRITE_MODES
+} WriteMode;
+
+static const char *const writeModeNames[NUM_WRITE_MODES] = {"write", "reserve"};
+
+typedef struct Config {
+  WriteMode mode;
+  int payloadBytes;
+  int pipeBytes;
+  long messages;
+  const char *placement;
+  int producerCpu;
+  int consumerCpu;
+} Config;
+
+static TinyPipe pipe_;
+static Config config;
+
+static void *produce(void *arg) {
+  (void) arg;
+  bench_pinThread(config.producerCpu);
+  char *payload = (char *) malloc(config.payloadBytes);
+  assert(payload != NULL);
+  memset(payload, 1, config.payloadBytes);
+
+  int spins = 0;
+  if (config.mode == WRITE_MODE_WRITE) {
+    for (long i = 0; i < config.messages; ++i) {
+      while (!tpipe_write(&pipe_, payload, config.payloadBytes)) bench_relax(&spins);
+      spins = 0;
+    }
+  } else {
+    for (long i = 0; i < config.messages; ++i) {
+      char *buffer;
+      while ((buffer = tpipe_getWriteBuffer(&pipe_, config.payloadBytes)) == NULL) bench_relax(&spins);
+      spins = 0;
+      memset(buffer, 1, config.payloadBytes);
+      tpipe_produce(&pipe_, config.payloadBytes);
+    }
+  }
+  free(payload);
+  return NULL;
+}
+
+// Runs the producer and consumer over one combination, and prints the results.
+static void run(int csv) {
+  tpipe_init(&pipe_, config.pipeBytes);
+  bench_pinThread(config.consumerCpu);
+
+  pthread_t producer;
+  const double start = bench_getSeconds();
+  pthread_create(&producer, NULL, produce, NULL);
+
+  // consume, touching every cache line of the payload
+  uint64_t checksum = 0;
+  int spins = 0;
+  for (long i = 0; i < config.messages; ++i) {
+    while (!tpipe_hasData(&pipe_)) bench_relax(&spins);
+    spins = 0;
+    int len = 0;
+    const char *buffer = tpipe_getReadBuffer(&pipe_, &len);
+    for (int j = 0; j < len; j += 64) checksum += (uint8_t) buffer[j];
+    tpipe_consume(&pipe_);
+  }
+  const double elapsed = bench_getSeconds() - start;
+  pthread_join(producer, NULL);
+  assert(checksum == (uint64_t) config.messages * ((config.payloadBytes + 63) / 64));
+
+  const double messagesPerSecond = config.messages / elapsed;
+  const double gigabytesPerSecond = (double) config.messages * config.payloadBytes / elapsed / 1e9;
+  if (csv) {
+    printf("%s,%d,%d,%s,%d,%d,%ld,%.0f,%.3f\n",
+        writeModeNames[config.mode], config.payloadBytes, config.pipeBytes, config.placement,
+        config.producerCpu, config.consumerCpu, config.messages,
+        messagesPerSecond, gigabytesPerSecond);
+  } else {
+    printf("mode=%s payload=%d pipe=%d placement=%s producer_cpu=%d consumer_cpu=%d msgs=%ld msgs/s=%.0f GB/s=%.3f\n",
+        writeModeNames[config.mode], config.payloadBytes, config.pipeBytes, config.placement,
+        config.producerCpu, config.consumerCpu, config.messages,
+        messagesPerSecond, gigabytesPerSecond);
+  }
+  fflush(stdout);
+  tpipe_free(&pipe_);
+}
+
+int main(int argc, char *argv[]) {
+  int modes[NUM_WRITE_MODES] = {WRITE_MODE_WRITE, WRITE_MODE_RESERVE};
+  int numModes = NUM_WRITE_MODES;
+  int payloadSizes[MAX_VALUES] = {1, 8, 64, 512, 4096, 65536, 1024 * 1024};
+  int numPayloadSizes = 7;
+  int pipeSizes[MAX_VALUES] = {16 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024};
+  int numPipeSizes = 4;
+  const char *placements[MAX_VALUES] = {"none"};
+  int numPlacements = 1;
+  char *placementList = NULL;
+  long messages = 5000000;
+  int producerCpu = -1;
+  int consumerCpu = -1;
+  int csv = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:s:p:L:P:C:n:c")) != -1) {
+    switch (opt) {
+      case 'm': {
+        numModes = 0;
+        if (strstr(optarg, "write") != NULL) modes[numModes++] = WRITE_MODE_WRITE;
+        if (strstr(optarg, "reserve") != NULL) modes[numModes++] = WRITE_MODE_RESERVE;
+        break;
+      }
+      case 's': numPayloadSizes = bench_parseList(optarg, payloadSizes, MAX_VALUES); break;
+      case 'p': numPipeSizes = bench_parseList(optarg, pipeSizes, MAX_VALUES); break;
+      case 'L': {
+        placementList = strdup(optarg);
+        numPlacements = 0;
+        for (char *t = strtok(placementList, ","); (t != NULL) && (numPlacements < MAX_VALUES); t = strtok(NULL, ",")) {
+          placements[numPlacements++] = t;
+        }
+        break;
+      }
+      case 'P': producerCpu = atoi(optarg); break;
+      case 'C': consumerCpu = atoi(optarg); break;
+      case 'n': messages = atol(optarg); break;
+      case 'c': csv = 1; break;
+      default: {
+        fprintf(stderr, "usage: %s [-m write,reserve] [-s bytes,...] [-p bytes,...] "
+            "[-L smt,core,socket] [-P cpu] [-C cpu] [-n messages] [-c]\n", argv[0]);
+        return 1;
+      }
+    }
+  }
+  if ((placementList == NULL) && ((producerCpu >= 0) || (consumerCpu >= 0))) placements[0] = "manual";
+
+  if (csv) printf("mode,payload,pipe,placement,producer_cpu,consumer_cpu,msgs,msgs_per_s,gb_per_s\n");
+  for (int l = 0; l < numPlacements; ++l) {
+    config.placement = placements[l];
+    config.producerCpu = producerCpu;
+    config.consumerCpu = consumerCpu;
+    if ((strcmp(config.placement, "none") != 0) && (strcmp(config.placement, "manual") != 0) &&
+        (bench_findCpuPair(config.placement, &config.producerCpu, &config.consumerCpu) != 0)) {
+      fprintf(stderr, "no pair of CPUs with placement %s, skipping\n", config.placement);
+      continue;
+    }
+    for (int m = 0; m < numModes; ++m) {
+      for (int i = 0; i < numPayloadSizes; ++i) {
+        for (int j = 0; j < numPipeSizes; ++j) {
+          config.mode = (WriteMode) modes[m];
+          config.payloadBytes = payloadSizes[i];
+          config.pipeBytes = pipeSizes[j];
+          if ((config.payloadBytes <= 0) || ((2 * config.payloadBytes) > config.pipeBytes)) continue;
+
+          // limit the bytes moved by runs with large payloads
+          config.messages = messages;
+          if (((long long) config.messages * config.payloadBytes) > MAX_BYTES_PER_RUN) {
+            config.messages = (long) (MAX_BYTES_PER_RUN / config.payloadBytes);
+          }
+          run(csv);
+        }
+      }
+    }
+  }
+  free(placementList);
+  return 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Runs a producer and a consumer thread over a pipe with credit-based flow
+// control, checking the order and contents of every record. The producer checks
+// that the data pipe is never full while it has the credit for a record, and at
+// the end that all of its credit has come back. Records are short, or a mix of
+// short records and records needing more than three quarters of the credit, which
+// can only be written once the consumer grants back credit it is holding below
+// the batch size. The consumer grants it back whenever it finds the pipe empty, as
+// described in tinypipe_credit.h, and the test fails if the producer stalls.
+//
+// cc -O1 -g -pthread -fsanitize=thread -DTPIPE_USE_ATOMICS=1 -I.. tpipe_credit.c ../tinypipe.c ../tinypipe_credit.c -o tpipe_credit
+// ./tpipe_credit [short|long] [number of records]
+
+#define _DEFAULT_SOURCE // for rand_r() and clock_gettime() in strict C modes
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe_credit.h"
+
+#define CREDIT_BYTES 8192
+#define CREDIT_MESSAGES 64
+
+// Enough for the credit, a header for each record, and the longest record wasted
+// when looping around the buffer.
+#define PIPE_BYTES ((2 * CREDIT_BYTES) + ((CREDIT_MESSAGES + 2) * TPIPE_HEADER_BYTES) + 64)
+
+#define STALL_SECONDS 10
+
+typedef enum CreditMode {
+  CREDIT_SHORT,
+  CREDIT_LONG,
+  CREDIT_NUM_MODES
+} CreditMode;
+
+static const char *modeNames[CREDIT_NUM_MODES] = {"short", "long"};
+
+typedef struct Credit {
+  TinyPipeCredit pipe;
+  CreditMode mode;
+  long numRecords;
+  int done; // set by the producer after its last record
+  int failed; // set by the producer if the data pipe was full
+} Credit;
+
+// Records start with their sequence number. Short records are between 8 and 607
+// bytes long. In long mode, every sixteenth record is longer than three quarters
+// of the credit.
+static int recordBytes(CreditMode mode, long i) {
+  if ((mode == CREDIT_LONG) && ((i % 16) == 15)) {
+    return (3 * CREDIT_BYTES / 4) + 1 + (int) ((unsigned long) i * 7919ul % (CREDIT_BYTES / 4));
+  }
+  return 8 + (int) ((unsigned long) i * 7919ul % 600ul);
+}
+
+static char patternAt(long i, int k) {
+  return (char) (i + k);
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + (1e-9 * (double) t.tv_nsec);
+}
+
+static void *produce(void *arg) {
+  Credit *const s = (Credit *) arg;
+  TinyPipeCredit *const c = &s->pipe;
+  for (long i = 0; i < s->numRecords;) {
+    const int numBytes = recordBytes(s->mode, i);
+    char *const buffer = tpipe_creditGetWriteBuffer(c, numBytes);
+    if (buffer == NULL) {
+      // the credit has been collected, so it must have run out
+      if ((c->producer.bytes >= numBytes) && (c->producer.messages >= 1)) {
+        printf("record %ld of %d bytes refused with %lld bytes and %lld records of credit\n",
+            i, numBytes, (long long) c->producer.bytes, (long long) c->producer.messages);
+        __atomic_store_n(&s->failed, 1, __ATOMIC_RELEASE);
+        break;
+      }
+      sched_yield();
+      continue;
+    }
+    memcpy(buffer, &i, sizeof(i));
+    for (int k = (int) sizeof(i); k < numBytes; ++k) buffer[k] = patternAt(i, k);
+    tpipe_creditProduce(c, numBytes);
+    ++i;
+  }
+  __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Returns the number of records read, or -1 if a record is out of order or
+// corrupt, or the producer stalls.
+static long consume(Credit *s) {
+  TinyPipeCredit *const c = &s->pipe;
+  long numRead = 0;
+  double lastRead = now();
+  for (;;) {
+    if (!tpipe_hasData(&c->data)) {
+      // grant back the credit held below the batch size, or try again if the
+      // grant pipe is full
+      tpipe_creditFlush(c);
+      if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE) && !tpipe_hasData(&c->data)) {
+        return numRead;
+      }
+      if ((now() - lastRead) > STALL_SECONDS) {
+        printf("the producer stalled after record %ld\n", numRead - 1);
+        return -1;
+      }
+      sched_yield();
+      continue;
+    }
+    int numBytes = 0;
+    const char *const buffer = tpipe_getReadBuffer(&c->data, &numBytes);
+    long i;
+    memcpy(&i, buffer, sizeof(i));
+    if (i != numRead) {
+      printf("record %ld read after %ld\n", i, numRead - 1);
+      return -1;
+    }
+    if (numBytes != recordBytes(s->mode, i)) {
+      printf("record %ld is %d bytes long\n", i, numBytes);
+      return -1;
+    }
+    for (int k = (int) sizeof(i); k < numBytes; ++k) {
+      if (buffer[k] != patternAt(i, k)) {
+        printf("record %ld is corrupt at byte %d\n", i, k);
+        return -1;
+      }
+    }
+    tpipe_creditConsume(c);
+    ++numRead;
+    lastRead = now();
+  }
+}
+
+static int run(CreditMode mode, long numRecords) {
+  Credit s;
+  tpipe_creditInit(&s.pipe, PIPE_BYTES, CREDIT_BYTES, CREDIT_MESSAGES);
+  s.mode = mode;
+  s.numRecords = numRecords;
+  s.done = 0;
+  s.failed = 0;
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, produce, &s);
+  const long numRead = consume(&s);
+  if (numRead < 0) {
+    // the producer may never finish
+    printf("%-6s FAILED\n", modeNames[mode]);
+    exit(1);
+  }
+  pthread_join(producer, NULL);
+
+  // everything has been consumed and granted back
+  const int64_t creditBytes = tpipe_creditCollect(&s.pipe);
+  const int64_t creditMessages = s.pipe.producer.messages;
+  tpipe_creditFree(&s.pipe);
+
+  if (s.failed) {
+    printf("%-6s FAILED: the data pipe was full\n", modeNames[mode]);
+    return 1;
+  }
+  if (numRead != numRecords) {
+    printf("%-6s FAILED: %ld of %ld records read\n", modeNames[mode], numRead, numRecords);
+    return 1;
+  }
+  if ((creditBytes != CREDIT_BYTES) || (creditMessages != CREDIT_MESSAGES)) {
+    printf("%-6s FAILED: %lld bytes and %lld records of credit returned\n", modeNames[mode],
+        (long long) creditBytes, (long long) creditMessages);
+    return 1;
+  }
+  printf("%-6s %ld of %ld records read, all credit returned: ok\n", modeNames[mode], numRead, numRecords);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const long numRecords = (argc > 2) ? atol(argv[2]) : 100000;
+  int failures = 0;
+  for (int m = 0; m < CREDIT_NUM_MODES; ++m) {
+    if ((argc > 1) && (strcmp(argv[1], modeNames[m]) != 0)) continue;
+    failures += run((CreditMode) m, numRecords);
+  }
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Checks that every record of long streams survives tpipe_writeDelta() and
+// tpipe_readDelta() unchanged. Records have 1 to 13 words, so that groups of four
+// words are followed by every length of tail, and each word switches at random
+// between constant, stepping, quantised, continuous and random values, so that
+// every code and both byte orders of float exclusive ors occur. The pipe is small
+// so that records often wrap or end at the end of the buffer. Build it once as it
+// is, which decodes with SSSE3 on x86, and once with TPIPE_DELTA_SCALAR=1. Record
+// headers are not aligned, so UBSan's alignment check is left out.
+//
+// cc -O1 -g -fsanitize=address,undefined -fno-sanitize=alignment -I.. tpipe_delta.c ../tinypipe.c ../tinypipe_delta.c -lm -o tpipe_delta
+// cc -O1 -g -fsanitize=address,undefined -fno-sanitize=alignment -DTPIPE_DELTA_SCALAR=1 -I.. tpipe_delta.c ../tinypipe.c ../tinypipe_delta.c -lm -o tpipe_delta_scalar
+// ./tpipe_delta [records per layout]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinypipe.h"
+#include "tinypipe_delta.h"
+
+#define MAX_WORDS 13
+#define PIPE_BYTES 512
+
+typedef enum Regime {
+  REGIME_CONSTANT,
+  REGIME_STEP, // small integer steps up or down
+  REGIME_QUANTISED, // floats in steps of a power of two
+  REGIME_CONTINUOUS, // floats with noise in their low mantissa bits
+  REGIME_RANDOM, // random bits
+  NUM_REGIMES
+} Regime;
+
+// Generates the same stream of records for the producer and the consumer.
+typedef struct Generator {
+  uint64_t state;
+  int numWords;
+  Regime regimes[MAX_WORDS];
+  uint32_t words[MAX_WORDS];
+  float phases[MAX_WORDS];
+} Generator;
+
+static uint32_t nextRandom(Generator *g) {
+  // xorshift64*
+  g->state ^= g->state >> 12;
+  g->state ^= g->state << 25;
+  g->state ^= g->state >> 27;
+  return (uint32_t) ((g->state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static void initGenerator(Generator *g, int numWords, uint64_t seed) {
+  memset(g, 0, sizeof(*g));
+  g->state = seed;
+  g->numWords = numWords;
+}
+
+static uint32_t floatBits(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+static void nextRecord(Generator *g, uint32_t *record) {
+  for (int i = 0; i < g->numWords; ++i) {
+    if ((nextRandom(g) % 32) == 0) g->regimes[i] = (Regime) (nextRandom(g) % NUM_REGIMES);
+    const uint32_t r = nextRandom(g);
+    switch (g->regimes[i]) {
+      case REGIME_CONSTANT: break;
+      case REGIME_STEP: g->words[i] += (r % 512) - 256; break;
+      case REGIME_QUANTISED: {
+        g->words[i] = floatBits(ldexpf((float) ((int) (r % 4096) - 2048), -(int) (r >> 28)));
+        break;
+      }
+      case REGIME_CONTINUOUS: {
+        g->phases[i] += 0.01f;
+        g->words[i] = floatBits(230.0f * sinf(g->phases[i]) + (float) (r % 1000) * 1e-4f);
+        break;
+      }
+      default: g->words[i] = r; break;
+    }
+    record[i] = g->words[i];
+  }
+}
+
+// Returns the number of records which did not survive.
+static long runLayout(const char *layout, long numRecords) {
+  TinyPipe q;
+  tpipe_init(&q, PIPE_BYTES);
+  TinyPipeDelta encoder;
+  TinyPipeDelta decoder;
+  const int recordBytes = tpipe_deltaInit(&encoder, layout);
+  tpipe_deltaInit(&decoder, layout);
+  const int numWords = recordBytes / (int) sizeof(uint32_t);
+
+  Generator producer;
+  Generator consumer;
+  initGenerator(&producer, numWords, 0x9E3779B97F4A7C15ull + numWords);
+  initGenerator(&consumer, numWords, 0x9E3779B97F4A7C15ull + numWords);
+  uint32_t record[MAX_WORDS];
+  uint32_t expected[MAX_WORDS];
+  uint32_t decoded[MAX_WORDS];
+  long numWritten = 0;
+  long numRead = 0;
+  long numFailed = 0;
+  int pending = 0; // the next record has been generated but not yet written
+  while (numRead < numRecords) {
+    // fill the pipe, then drain it
+    while (numWritten < numRecords) {
+      if (!pending) nextRecord(&producer, record);
+      pending = !tpipe_writeDelta(&q, &encoder, (const char *) record);
+      if (pending) break;
+      ++numWritten;
+    }
+    while (tpipe_hasData(&q)) {
+      nextRecord(&consumer, expected);
+      if (!tpipe_readDelta(&q, &decoder, (char *) decoded)
+          || (memcmp(decoded, expected, recordBytes) != 0)) {
+        if (numFailed == 0) printf("%s: record %ld differs\n", layout, numRead);
+        ++numFailed;
+      }
+      tpipe_consume(&q);
+      ++numRead;
+    }
+  }
+
+  tpipe_deltaFree(&encoder);
+  tpipe_deltaFree(&decoder);
+  tpipe_free(&q);
+  return numFailed;
+}
+
+int main(int argc, char *argv[]) {
+  const long numRecords = (argc > 1) ? atol(argv[1]) : 100000;
+  static const char *const layouts[] = {
+    "i", "f", "if", "ffi", "iiff", "fifif", "ffffff", "iiffiff", "ffffffff",
+    "iffiffiff", "iiiiffffff", "ffiiffiiffi", "fffffffffffi", "iiiiffffffffi"
+  };
+  long numFailed = 0;
+  for (int l = 0; l < (int) (sizeof(layouts) / sizeof(layouts[0])); ++l) {
+    numFailed += runLayout(layouts[l], numRecords);
+  }
+#if TPIPE_DELTA_SCALAR
+  const char *const decoder = "scalar";
+#else
+  const char *const decoder = "default";
+#endif
+  if (numFailed > 0) {
+    printf("FAILED: %ld records differ (%s decoder)\n", numFailed, decoder);
+    return 1;
+  }
+  printf("%ld records of each of %d layouts: ok (%s decoder)\n", numRecords,
+      (int) (sizeof(layouts) / sizeof(layouts[0])), decoder);
+  return 0;
+}
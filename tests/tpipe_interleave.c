@@ -0,0 +1,480 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Explores the interleavings of a producer and a consumer over small scenarios of
+// wrapping, forwarding to a resized buffer and resetting. Both run as coroutines
+// under a deterministic scheduler, which may switch between them at every shared
+// load and store of the pipe (every tpipe_load() and tpipe_store() in tinypipe.c).
+// All schedules with up to a given number of preemptions are enumerated depth
+// first, with sequentially consistent memory. Then random schedules with any
+// number of preemptions are run, in which each thread's stores wait in a store
+// buffer and become visible to the other thread later, in any order. A store
+// buffer is drained by hv_sfence(), or by a release store with TPIPE_USE_ATOMICS=1,
+// so removing a fence or release which the protocol relies on makes the consumer
+// read stale data. The producer writes records with buffered stores too. Plain
+// stores inside tinypipe.c, such as forwarding addresses and reset positions, are
+// visible at once. Reordering of loads is not modelled.
+//
+// The consumer checks the order and contents of every record, and the assertions
+// in tinypipe.c are enabled. A failing enumerated schedule is printed as a string
+// of thread numbers (0 is the producer, 1 the consumer) at each scheduling point,
+// and a failing random schedule by its seed.
+//
+// cc -O1 -g -I.. tpipe_interleave.c -o tpipe_interleave
+// cc -O1 -g -DTPIPE_USE_ATOMICS=1 -I.. tpipe_interleave.c -o tpipe_interleave_atomics
+// ./tpipe_interleave [preemptions] [random schedules]
+
+#include <stddef.h>
+
+static void tpipe_schedule(void);
+static void tpipe_modelLoad(const void *p, void *value, size_t numBytes);
+static void tpipe_modelStore(void *p, const void *value, size_t numBytes);
+static void tpipe_modelFence(void);
+
+// every shared access is a scheduling point, and goes through the store buffers
+#define tpipe_load(p) __extension__ ({ \
+    __typeof__(*(p)) value_; \
+    tpipe_schedule(); \
+    tpipe_modelLoad((p), &value_, sizeof(value_)); \
+    value_; })
+#define tpipe_store(p, v) __extension__ ({ \
+    __typeof__(*(p)) value_ = (v); \
+    tpipe_schedule(); \
+    tpipe_modelStore((p), &value_, sizeof(value_)); })
+#define hv_sfence() tpipe_modelFence()
+
+#ifdef NDEBUG
+  #error the assertions in tinypipe.c must be enabled
+#endif
+
+// this also defines _DEFAULT_SOURCE, for ucontext in strict C modes
+#include "../tinypipe.c"
+
+#include <signal.h>
+#include <stdio.h>
+#include <ucontext.h>
+
+#define NUM_THREADS 2
+#define MAX_STEPS 8192
+#define MAX_PENDING_STORES 64
+#define STACK_BYTES (64 * 1024)
+
+// A store which the other thread can't see yet. It has been written to memory, and
+// the other thread's loads see the bytes it replaced.
+typedef struct PendingStore {
+  char *address;
+  int numBytes;
+  int thread;
+  char oldBytes[sizeof(uint64_t)];
+} PendingStore;
+
+typedef struct Scheduler {
+  ucontext_t main;
+  ucontext_t threads[NUM_THREADS];
+  char stacks[NUM_THREADS][STACK_BYTES];
+  int current; // the running thread, or -1 if the scheduler is not running
+  int finished[NUM_THREADS];
+  int waiting[NUM_THREADS]; // the thread can't make progress until the other stores
+  long stores[NUM_THREADS]; // the number of shared stores made visible by each thread
+  long seenStores[NUM_THREADS]; // the other thread's stores when this one last waited
+  int preemptions;
+  int maxPreemptions;
+  unsigned int seed; // random schedules are chosen with store buffers if not 0
+  unsigned int firstSeed;
+
+  // pending stores of both threads, oldest first
+  PendingStore pending[MAX_PENDING_STORES];
+  int numPending;
+
+  // the schedule is replayed up to replaySteps, then extended
+  int steps;
+  int replaySteps;
+  signed char choices[MAX_STEPS]; // the thread run after each scheduling point
+  signed char alternatives[MAX_STEPS]; // the other thread is still to be explored
+} Scheduler;
+
+typedef struct Scenario {
+  const char *name;
+  int pipeBytes;
+  void (*produce)(void);
+  void (*consume)(void);
+} Scenario;
+
+static Scheduler S;
+static TinyPipe P;
+static int done; // set by the producer after its last record
+static int numRead;
+static int lastRead;
+
+static void printSchedule(void) {
+  if (S.firstSeed != 0) {
+    fprintf(stderr, "random schedule with seed %u (%d steps)\n", S.firstSeed, S.steps);
+    return;
+  }
+  fprintf(stderr, "schedule (%d steps, %d preemptions): ", S.steps, S.preemptions);
+  for (int i = 0; i < S.steps; ++i) fputc('0' + S.choices[i], stderr);
+  fputc('\n', stderr);
+}
+
+static void fail(const char *message) {
+  fprintf(stderr, "FAILED: %s\n", message);
+  printSchedule();
+  exit(1);
+}
+
+static void onAbort(int sig) {
+  (void) sig;
+  printSchedule(); // an assertion in tinypipe.c has failed
+}
+
+static int isRunnable(int t) {
+  return !S.finished[t] && !S.waiting[t];
+}
+
+// Makes a store visible to the other thread, which may then make progress.
+static void makeVisible(int i) {
+  const int t = S.pending[i].thread;
+  memmove(&S.pending[i], &S.pending[i + 1], (S.numPending - i - 1) * sizeof(PendingStore));
+  --S.numPending;
+  ++S.stores[t];
+  S.waiting[1 - t] = 0;
+}
+
+// Returns 1 if an earlier store of the same thread overlaps the pending store, in
+// which case it must not become visible first.
+static int isBehindEarlierStore(int i) {
+  const PendingStore *const s = &S.pending[i];
+  for (int j = 0; j < i; ++j) {
+    const PendingStore *const e = &S.pending[j];
+    if ((e->thread == s->thread) && (e->address < (s->address + s->numBytes))
+        && (s->address < (e->address + e->numBytes))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Makes all stores of a thread visible, or of both threads if t is -1.
+static void drainStores(int t) {
+  int i = 0;
+  while (i < S.numPending) {
+    if ((t < 0) || (S.pending[i].thread == t)) makeVisible(i);
+    else ++i;
+  }
+}
+
+// Makes some pending stores visible at random, in any order.
+static void drainRandomStores(void) {
+  int i = 0;
+  while (i < S.numPending) {
+    if (((rand_r(&S.seed) % 4) == 0) && !isBehindEarlierStore(i)) makeVisible(i);
+    else ++i;
+  }
+}
+
+static void tpipe_modelLoad(const void *p, void *value, size_t numBytes) {
+  memcpy(value, p, numBytes);
+  if (S.current < 0) return;
+
+  // undo the other thread's pending stores, newest first
+  const char *const address = (const char *) p;
+  for (int i = S.numPending - 1; i >= 0; --i) {
+    const PendingStore *const s = &S.pending[i];
+    if (s->thread == S.current) continue;
+    for (int k = 0; k < s->numBytes; ++k) {
+      const ptrdiff_t offset = (s->address + k) - address;
+      if ((offset >= 0) && (offset < (ptrdiff_t) numBytes)) ((char *) value)[offset] = s->oldBytes[k];
+    }
+  }
+}
+
+// Stores to shared memory, in the current thread's store buffer if schedules are
+// random.
+static void bufferStore(void *p, const void *value, size_t numBytes) {
+  const int current = S.current;
+  if ((current < 0) || (S.seed == 0)) {
+    // sequentially consistent
+    memcpy(p, value, numBytes);
+    if (current >= 0) {
+      ++S.stores[current];
+      S.waiting[1 - current] = 0;
+    }
+    return;
+  }
+
+  if (S.numPending == MAX_PENDING_STORES) makeVisible(0);
+  PendingStore *const s = &S.pending[S.numPending++];
+  s->address = (char *) p;
+  s->numBytes = (int) numBytes;
+  s->thread = current;
+  memcpy(s->oldBytes, p, numBytes);
+  memcpy(p, value, numBytes);
+}
+
+static void tpipe_modelStore(void *p, const void *value, size_t numBytes) {
+#if TPIPE_USE_ATOMICS
+  // a release store makes the stores before it visible first
+  if (S.current >= 0) drainStores(S.current);
+#endif
+  bufferStore(p, value, numBytes);
+}
+
+static void tpipe_modelFence(void) {
+#if !TPIPE_USE_ATOMICS
+  if (S.current >= 0) drainStores(S.current);
+#endif
+}
+
+// Chooses the thread to run next and switches to it.
+static void tpipe_schedule(void) {
+  const int current = S.current;
+  if (current < 0) return; // the pipe is being set up or torn down
+  const int other = 1 - current;
+  if (S.steps >= MAX_STEPS) fail("too many steps, is a thread spinning?");
+  if (S.seed != 0) drainRandomStores();
+
+  // the threads may only be waiting for each other's pending stores
+  if (!isRunnable(current) && !isRunnable(other)) drainStores(-1);
+
+  int next;
+  if (S.steps < S.replaySteps) {
+    next = S.choices[S.steps];
+  } else {
+    int canSwitch = isRunnable(other);
+    if (!isRunnable(current)) {
+      if (!canSwitch) fail("deadlock");
+      next = other;
+      canSwitch = 0;
+    } else if (S.seed != 0) {
+      next = (canSwitch && (rand_r(&S.seed) % 4) == 0) ? other : current;
+      canSwitch = 0;
+    } else {
+      next = current;
+      canSwitch = canSwitch && (S.preemptions < S.maxPreemptions);
+    }
+    S.choices[S.steps] = (signed char) next;
+    S.alternatives[S.steps] = (signed char) canSwitch;
+  }
+  ++S.steps;
+
+  if (next != current) {
+    if (isRunnable(current)) ++S.preemptions;
+    S.current = next;
+    swapcontext(&S.threads[current], &S.threads[next]);
+  }
+}
+
+// Waits for the other thread to store something. If it has done so since this
+// thread last waited, the store may already have been missed, so only yields.
+static void waitForOther(void) {
+  const int current = S.current;
+  const long stores = S.stores[1 - current];
+  if (stores == S.seenStores[current]) S.waiting[current] = 1;
+  S.seenStores[current] = stores;
+  tpipe_schedule();
+}
+
+static const Scenario *runningScenario;
+
+static void runThread(int t) {
+  if (t == 0) runningScenario->produce();
+  else runningScenario->consume();
+  drainStores(t);
+  S.finished[t] = 1;
+  const int other = 1 - t;
+  if (S.finished[other]) {
+    S.current = -1;
+    setcontext(&S.main);
+  }
+  if (S.waiting[other]) fail("deadlock");
+  S.current = other;
+  setcontext(&S.threads[other]);
+}
+
+// Runs the scenario once under the current schedule.
+static void runOnce(const Scenario *scenario) {
+  tpipe_init(&P, scenario->pipeBytes);
+  done = 0;
+  numRead = 0;
+  lastRead = -1;
+  runningScenario = scenario;
+  S.steps = 0;
+  S.preemptions = 0;
+  S.numPending = 0;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    S.finished[t] = 0;
+    S.waiting[t] = 0;
+    S.stores[t] = 0;
+    S.seenStores[t] = 0;
+    getcontext(&S.threads[t]);
+    S.threads[t].uc_stack.ss_sp = S.stacks[t];
+    S.threads[t].uc_stack.ss_size = STACK_BYTES;
+    S.threads[t].uc_link = NULL;
+    makecontext(&S.threads[t], (void (*)(void)) runThread, 1, t);
+  }
+
+  // either thread may start first
+  S.current = 0;
+  if (S.steps < S.replaySteps) S.current = S.choices[0];
+  else S.choices[0] = 0, S.alternatives[0] = (signed char) (S.seed == 0);
+  if (S.seed != 0) S.current = S.choices[0] = (signed char) (rand_r(&S.seed) % 2);
+  S.steps = 1;
+  swapcontext(&S.main, &S.threads[S.current]);
+
+  tpipe_free(&P);
+}
+
+// Moves on to the next schedule in depth-first order. Returns 0 when all have
+// been explored.
+static int nextSchedule(void) {
+  int i = S.steps - 1;
+  while ((i >= 0) && !S.alternatives[i]) --i;
+  if (i < 0) return 0;
+  S.choices[i] = (signed char) (1 - S.choices[i]);
+  S.alternatives[i] = 0;
+  S.replaySteps = i + 1;
+  return 1;
+}
+
+// Pipes hold only a few records, so that they wrap often. Their sizes grow with
+// the record header, which is longer with timestamps.
+#define PIPE_BYTES(n) ((n) + (6 * TPIPE_HEADER_BYTES))
+
+// Records have a length of 4 to 12 bytes and are filled with their sequence number.
+static int recordBytes(int i) {
+  return 4 + 4 * (i % 3);
+}
+
+static void writeRecord(int i) {
+  char *buffer;
+  while ((buffer = tpipe_getWriteBuffer(&P, recordBytes(i))) == NULL) waitForOther();
+  for (int k = 0; k < recordBytes(i); ++k) {
+    const char c = (char) i;
+    tpipe_schedule();
+    bufferStore(&buffer[k], &c, sizeof(c));
+  }
+  tpipe_produce(&P, recordBytes(i));
+}
+
+static void resizePipe(int numBytes) {
+  while (tpipe_resize(&P, numBytes) == 0) waitForOther();
+}
+
+// Reads a record, checking that it follows the last one and is intact.
+static void readRecord(int contiguous) {
+  int numBytes = 0;
+  char *buffer = tpipe_getReadBuffer(&P, &numBytes);
+  const int i = tpipe_load(&buffer[0]);
+  if (contiguous ? (i != (lastRead + 1)) : (i <= lastRead)) fail("records out of order");
+  if (numBytes != recordBytes(i)) fail("wrong record length");
+  for (int k = 0; k < numBytes; ++k) {
+    if (tpipe_load(&buffer[k]) != i) fail("corrupt record");
+  }
+  tpipe_consume(&P);
+  lastRead = i;
+  ++numRead;
+}
+
+// The write head loops around the buffer several times.
+static void produceWrap(void) {
+  for (int i = 0; i < 6; ++i) writeRecord(i);
+}
+
+static void consumeWrap(void) {
+  while (numRead < 6) {
+    if (tpipe_hasData(&P)) readRecord(1);
+    else waitForOther();
+  }
+}
+
+// The pipe is resized while records are in it, once shrinking and once growing.
+static void produceForward(void) {
+  writeRecord(0);
+  writeRecord(1);
+  resizePipe(PIPE_BYTES(12));
+  writeRecord(2);
+  writeRecord(3);
+  resizePipe(PIPE_BYTES(32));
+  writeRecord(4);
+  writeRecord(5);
+}
+
+// The consumer requests resets while the producer is wrapping and resizing.
+static void produceReset(void) {
+  for (int i = 0; i < 7; ++i) {
+    if (i == 3) resizePipe(PIPE_BYTES(16));
+    writeRecord(i);
+  }
+  tpipe_store(&done, 1);
+}
+
+static void consumeReset(void) {
+  int resets = 0;
+  for (;;) {
+    if (tpipe_hasData(&P)) {
+      readRecord(0);
+      if (((lastRead == 1) || (lastRead == 4)) && (resets < 2)) {
+        tpipe_requestReset(&P);
+        ++resets;
+      }
+    } else if (tpipe_load(&done) && !tpipe_hasData(&P)) {
+      return; // everything has been read or discarded
+    } else {
+      waitForOther();
+    }
+  }
+}
+
+static const Scenario scenarios[] = {
+  {"wrap", PIPE_BYTES(16), produceWrap, consumeWrap},
+  {"forward", PIPE_BYTES(8), produceForward, consumeWrap},
+  {"reset", PIPE_BYTES(12), produceReset, consumeReset},
+};
+
+int main(int argc, char *argv[]) {
+  const int maxPreemptions = (argc > 1) ? atoi(argv[1]) : 2;
+  const int numRandom = (argc > 2) ? atoi(argv[2]) : 10000;
+  signal(SIGABRT, onAbort);
+  S.current = -1;
+
+  for (int s = 0; s < (int) (sizeof(scenarios) / sizeof(scenarios[0])); ++s) {
+    const Scenario *const scenario = &scenarios[s];
+    long numSchedules = 0;
+    long maxSteps = 0;
+
+    S.maxPreemptions = maxPreemptions;
+    S.seed = 0;
+    S.firstSeed = 0;
+    S.replaySteps = 0;
+    do {
+      runOnce(scenario);
+      ++numSchedules;
+      if (S.steps > maxSteps) maxSteps = S.steps;
+    } while (nextSchedule());
+
+    for (int i = 0; i < numRandom; ++i) {
+      S.seed = (unsigned int) i + 1;
+      S.firstSeed = S.seed;
+      S.replaySteps = 0;
+      runOnce(scenario);
+    }
+
+    printf("%-8s %ld schedules with up to %d preemptions (up to %ld steps), %d random: ok\n",
+        scenario->name, numSchedules, maxPreemptions, maxSteps, numRandom);
+  }
+  return 0;
+}
@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Checks the LZ codec and the compressed record functions, whose fast paths copy
+// up to 16 bytes more than they need to. Every buffer is allocated with exactly
+// the size the codec is given, so that AddressSanitizer reports any access beyond
+// it. Compressible, incompressible and run-heavy inputs are round tripped at
+// lengths around TPIPE_COMPRESS_MIN_BYTES and TPIPE_COMPRESS_SCRATCH_BYTES and up
+// to 90000 bytes, directly, as records which exactly fill a pipe and as records
+// which wrap a pipe. Compressed data is then decompressed with bits flipped in
+// turn and truncated to many lengths (every one for short inputs), which must fail
+// cleanly or produce no more than the space given. Record headers are not aligned,
+// so UBSan's alignment check is left out.
+//
+// cc -O1 -g -fsanitize=address,undefined -fno-sanitize=alignment -I.. tpipe_lz.c ../tinypipe.c ../tinypipe_lz.c -o tpipe_lz
+// ./tpipe_lz
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinypipe.h"
+#include "tinypipe_lz.h"
+
+#define PIPE_BYTES (256 * 1024) // an empty pipe always has room for the longest record
+#define MAX_RECORD_BYTES 90000
+
+typedef enum Input {
+  INPUT_TEXT, // repeated words, which compress well
+  INPUT_RANDOM, // random bytes, which don't compress
+  INPUT_RUNS, // runs of short repeating patterns, with overlapping matches
+  INPUT_MIXED, // random bytes repeated once, which compress to about half
+  NUM_INPUTS
+} Input;
+
+static const char *inputNames[NUM_INPUTS] = {"text", "random", "runs", "mixed"};
+
+static int numFailures = 0;
+
+static uint32_t nextRandom(uint32_t *state) {
+  // xorshift32
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void fillInput(char *data, int numBytes, Input input, uint32_t *state) {
+  static const char *const words[] = {"pipe ", "record ", "producer ", "consumer ", "buffer "};
+  int i = 0;
+  while (i < numBytes) {
+    switch (input) {
+      case INPUT_TEXT: {
+        const char *const word = words[nextRandom(state) % 5];
+        for (int k = 0; (word[k] != '\0') && (i < numBytes); ++k) data[i++] = word[k];
+        break;
+      }
+      case INPUT_RUNS: {
+        // patterns of 1 to 12 bytes give match offsets on both sides of the
+        // 8-byte match copy
+        const int period = 1 + (int) (nextRandom(state) % 12);
+        const int runBytes = 1 + (int) (nextRandom(state) % 300);
+        for (int k = 0; (k < runBytes) && (i < numBytes); ++k, ++i) {
+          data[i] = (k < period) ? (char) nextRandom(state) : data[i - period];
+        }
+        break;
+      }
+      case INPUT_MIXED: {
+        data[i] = (i < (numBytes / 2)) ? (char) nextRandom(state) : data[i - (numBytes / 2)];
+        ++i;
+        break;
+      }
+      default: data[i++] = (char) nextRandom(state); break;
+    }
+  }
+}
+
+// Allocates exactly the given number of bytes, so that any access beyond them is
+// reported.
+static char *allocateExactly(int numBytes) {
+  char *const buffer = (char *) malloc((numBytes > 0) ? numBytes : 1);
+  if (buffer == NULL) abort();
+  return buffer;
+}
+
+static char *copyExactly(const char *data, int numBytes) {
+  char *const copy = allocateExactly(numBytes);
+  memcpy(copy, data, numBytes);
+  return copy;
+}
+
+static void fail(const char *what, Input input, int numBytes) {
+  if (numFailures++ < 10) printf("%s failed: %s input of %d bytes\n", what, inputNames[input], numBytes);
+}
+
+// Decompresses the data with each bit flipped in turn, and truncated to each
+// length. Neither may write beyond the output or report more than fits in it.
+static void checkCorruption(const char *compressed, int compressedBytes, int numBytes,
+    Input input) {
+  char *const output = allocateExactly(numBytes);
+  const int step = 1 + (compressedBytes / 64); // sample the bits and lengths of long inputs
+  for (int bit = 0; bit < (8 * compressedBytes); bit += step) {
+    char *const corrupt = copyExactly(compressed, compressedBytes);
+    corrupt[bit / 8] ^= (char) (1 << (bit % 8));
+    if (tpipe_lzDecompress(corrupt, compressedBytes, output, numBytes) > numBytes) {
+      fail("bit flipped decompression", input, numBytes);
+    }
+    free(corrupt);
+  }
+  for (int len = 0; len < compressedBytes; len += step) {
+    char *const truncated = copyExactly(compressed, len);
+    if (tpipe_lzDecompress(truncated, len, output, numBytes) > numBytes) {
+      fail("truncated decompression", input, numBytes);
+    }
+    free(truncated);
+  }
+  free(output);
+}
+
+// Compresses and decompresses the data directly.
+static void checkCodec(const char *data, int numBytes, Input input, int corrupt) {
+  char *const src = copyExactly(data, numBytes);
+  const int bound = tpipe_lzGetBound(numBytes);
+  char *const compressed = allocateExactly(bound);
+  const int compressedBytes = tpipe_lzCompress(src, numBytes, compressed, bound);
+  if (compressedBytes <= 0) {
+    fail("compression within the bound", input, numBytes);
+    free(compressed);
+    free(src);
+    return;
+  }
+
+  // the compressed data must not fit in any less space
+  char *const tight = allocateExactly(compressedBytes - 1);
+  if (tpipe_lzCompress(src, numBytes, tight, compressedBytes - 1) != 0) {
+    fail("compression into too little space", input, numBytes);
+  }
+  free(tight);
+
+  char *const exact = copyExactly(compressed, compressedBytes);
+  char *const output = allocateExactly(numBytes);
+  if ((tpipe_lzDecompress(exact, compressedBytes, output, numBytes) != numBytes)
+      || (memcmp(output, data, numBytes) != 0)) {
+    fail("round trip", input, numBytes);
+  }
+  if ((numBytes > 0) && (tpipe_lzDecompress(exact, compressedBytes, output, numBytes - 1) != -1)) {
+    fail("decompression into too little space", input, numBytes);
+  }
+  if (corrupt) checkCorruption(exact, compressedBytes, numBytes, input);
+
+  free(output);
+  free(exact);
+  free(compressed);
+  free(src);
+}
+
+// Writes the data as a record to a pipe with room for exactly one uncompressed
+// record, so that any write beyond the space reserved for it, e.g. when compressing
+// directly into the pipe, goes beyond the buffer.
+static void checkExactPipe(const char *data, int numBytes, Input input) {
+  TinyPipe q;
+  tpipe_init(&q, TPIPE_HEADER_BYTES + (int) sizeof(uint32_t) + numBytes + (int) sizeof(int32_t));
+  char *const output = allocateExactly(numBytes);
+  if (!tpipe_writeCompressed(&q, data, numBytes)
+      || (tpipe_readCompressed(&q, output, numBytes) != numBytes)
+      || (memcmp(output, data, numBytes) != 0)) {
+    fail("exactly sized pipe round trip", input, numBytes);
+  }
+  tpipe_consume(&q);
+  free(output);
+  tpipe_free(&q);
+}
+
+// Writes records of the given lengths and inputs through a pipe, reading them all
+// back whenever it is full, so that they wrap around it.
+static void checkPipe(const int *lengths, int numLengths, int numRecords) {
+  TinyPipe q;
+  tpipe_init(&q, PIPE_BYTES);
+  char *const data = allocateExactly(MAX_RECORD_BYTES);
+  uint32_t writeState = 7;
+  uint32_t readState = 7;
+  int numWritten = 0;
+  int numRead = 0;
+  while (numRead < numRecords) {
+    while (numWritten < numRecords) {
+      const int numBytes = lengths[(numWritten * 7) % numLengths];
+      const Input input = (Input) (numWritten % NUM_INPUTS);
+      uint32_t state = writeState;
+      fillInput(data, numBytes, input, &state);
+      if (!tpipe_writeCompressed(&q, data, numBytes)) break;
+      writeState = state;
+      ++numWritten;
+    }
+    while (tpipe_hasData(&q)) {
+      const int numBytes = lengths[(numRead * 7) % numLengths];
+      const Input input = (Input) (numRead % NUM_INPUTS);
+      fillInput(data, numBytes, input, &readState);
+      char *const output = allocateExactly(numBytes);
+      if ((tpipe_getDecompressedSize(&q) != numBytes)
+          || (tpipe_readCompressed(&q, output, numBytes) != numBytes)
+          || (memcmp(output, data, numBytes) != 0)) {
+        fail("pipe round trip", input, numBytes);
+      }
+      free(output);
+      tpipe_consume(&q);
+      ++numRead;
+    }
+  }
+  free(data);
+  tpipe_free(&q);
+}
+
+int main(void) {
+  // lengths around the thresholds, and some long ones
+  int lengths[128];
+  int numLengths = 0;
+  for (int n = 0; n <= 16; ++n) lengths[numLengths++] = n;
+  for (int n = -16; n <= 16; n += 2) lengths[numLengths++] = TPIPE_COMPRESS_MIN_BYTES + n;
+  for (int n = -16; n <= 16; n += 2) lengths[numLengths++] = TPIPE_COMPRESS_SCRATCH_BYTES + n;
+  for (int n = -8; n <= 8; n += 4) lengths[numLengths++] = (2 * TPIPE_COMPRESS_SCRATCH_BYTES) + n;
+  lengths[numLengths++] = 20000;
+  lengths[numLengths++] = 65537;
+  lengths[numLengths++] = MAX_RECORD_BYTES;
+
+  char *const data = allocateExactly(MAX_RECORD_BYTES);
+  uint32_t state = 1;
+  int numInputs = 0;
+  for (int i = 0; i < numLengths; ++i) {
+    for (int input = 0; input < NUM_INPUTS; ++input) {
+      fillInput(data, lengths[i], (Input) input, &state);
+      checkCodec(data, lengths[i], (Input) input, lengths[i] <= (2 * TPIPE_COMPRESS_SCRATCH_BYTES));
+      checkExactPipe(data, lengths[i], (Input) input);
+      ++numInputs;
+    }
+  }
+  free(data);
+
+  const int numRecords = 4000;
+  checkPipe(lengths, numLengths, numRecords);
+
+  if (numFailures > 0) {
+    printf("FAILED: %d checks\n", numFailures);
+    return 1;
+  }
+  printf("%d inputs round tripped, corrupted and truncated, %d records through the pipe: ok\n",
+      numInputs, numRecords);
+  return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Checks that the real-time profile makes no allocations and no system calls once
+// the pipe has been initialised. The allocator and the system calls which the pipe
+// could make are wrapped at link time and counted while a producer and a consumer
+// thread write, read and reset records of 8B to 768KB (the largest are copied with
+// streaming stores). Any call to them from the pipe fails the test. The test's own
+// calls to sched_yield() are not counted. Add -DTPIPE_ENABLE_STATS=1 to include
+// the statistics.
+//
+// WRAP=-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free,--wrap=posix_memalign
+// WRAP=$WRAP,--wrap=mmap,--wrap=munmap,--wrap=madvise,--wrap=sysconf,--wrap=write
+// WRAP=$WRAP,--wrap=nanosleep,--wrap=pthread_mutex_lock
+// cc -O1 -g -pthread -DTPIPE_RT_SAFE=1 -I.. tpipe_rt.c ../tinypipe.c $WRAP -o tpipe_rt
+// ./tpipe_rt [number of records]
+
+#define _DEFAULT_SOURCE // for madvise() and nanosleep() in strict C modes
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tinypipe.h"
+
+#if !TPIPE_RT_SAFE
+  #error build with -DTPIPE_RT_SAFE=1
+#endif
+
+#define MAX_RECORD_BYTES (768 * 1024)
+
+typedef enum Call {
+  CALL_MALLOC,
+  CALL_CALLOC,
+  CALL_REALLOC,
+  CALL_FREE,
+  CALL_POSIX_MEMALIGN,
+  CALL_MMAP,
+  CALL_MUNMAP,
+  CALL_MADVISE,
+  CALL_SYSCONF,
+  CALL_WRITE,
+  CALL_NANOSLEEP,
+  CALL_PTHREAD_MUTEX_LOCK,
+  NUM_CALLS
+} Call;
+
+static const char *callNames[NUM_CALLS] = {
+  "malloc", "calloc", "realloc", "free", "posix_memalign", "mmap", "munmap",
+  "madvise", "sysconf", "write", "nanosleep", "pthread_mutex_lock"
+};
+
+static int armed; // calls are counted while this is set
+static long calls[NUM_CALLS];
+
+static void countCall(Call call) {
+  if (__atomic_load_n(&armed, __ATOMIC_RELAXED)) __atomic_add_fetch(&calls[call], 1, __ATOMIC_RELAXED);
+}
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+int __real_posix_memalign(void **p, size_t alignment, size_t size);
+void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int __real_munmap(void *addr, size_t length);
+int __real_madvise(void *addr, size_t length, int advice);
+long __real_sysconf(int name);
+ssize_t __real_write(int fd, const void *buffer, size_t count);
+int __real_nanosleep(const struct timespec *duration, struct timespec *remaining);
+int __real_pthread_mutex_lock(pthread_mutex_t *mutex);
+
+void *__wrap_malloc(size_t size) {
+  countCall(CALL_MALLOC);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  countCall(CALL_CALLOC);
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  countCall(CALL_REALLOC);
+  return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p) {
+  countCall(CALL_FREE);
+  __real_free(p);
+}
+
+int __wrap_posix_memalign(void **p, size_t alignment, size_t size) {
+  countCall(CALL_POSIX_MEMALIGN);
+  return __real_posix_memalign(p, alignment, size);
+}
+
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+  countCall(CALL_MMAP);
+  return __real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+int __wrap_munmap(void *addr, size_t length) {
+  countCall(CALL_MUNMAP);
+  return __real_munmap(addr, length);
+}
+
+int __wrap_madvise(void *addr, size_t length, int advice) {
+  countCall(CALL_MADVISE);
+  return __real_madvise(addr, length, advice);
+}
+
+long __wrap_sysconf(int name) {
+  countCall(CALL_SYSCONF);
+  return __real_sysconf(name);
+}
+
+ssize_t __wrap_write(int fd, const void *buffer, size_t count) {
+  countCall(CALL_WRITE);
+  return __real_write(fd, buffer, count);
+}
+
+int __wrap_nanosleep(const struct timespec *duration, struct timespec *remaining) {
+  countCall(CALL_NANOSLEEP);
+  return __real_nanosleep(duration, remaining);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t *mutex) {
+  countCall(CALL_PTHREAD_MUTEX_LOCK);
+  return __real_pthread_mutex_lock(mutex);
+}
+
+typedef struct RtTest {
+  TinyPipe pipe;
+  long numRecords;
+  int started; // set once counting has begun
+  int finished; // set by the producer after its last record
+  char source[MAX_RECORD_BYTES];
+} RtTest;
+
+// Most records are short. Every 1000th is long enough to be copied with
+// streaming stores.
+static int recordBytes(long i) {
+  if ((i % 1000) == 999) return MAX_RECORD_BYTES;
+  return 8 + (int) ((unsigned long) i * 7919ul % 300ul);
+}
+
+static void *produce(void *arg) {
+  RtTest *const t = (RtTest *) arg;
+  while (!__atomic_load_n(&t->started, __ATOMIC_ACQUIRE)) sched_yield();
+
+  // alternate between writing in place and copying with tpipe_write()
+  for (long i = 0; i < t->numRecords;) {
+    const int numBytes = recordBytes(i);
+    int success = 0;
+    if (i & 1) {
+      memcpy(t->source, &i, sizeof(i));
+      success = tpipe_write(&t->pipe, t->source, numBytes);
+    } else {
+      char *const buffer = tpipe_getWriteBuffer(&t->pipe, numBytes);
+      if (buffer != NULL) {
+        memcpy(buffer, &i, sizeof(i));
+        tpipe_produce(&t->pipe, numBytes);
+        success = 1;
+      }
+    }
+    if (success) ++i;
+    else sched_yield(); // the pipe is full
+  }
+
+  // don't exit, which frees the thread's resources, until counting has stopped
+  __atomic_store_n(&t->finished, 1, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&armed, __ATOMIC_ACQUIRE)) sched_yield();
+  return NULL;
+}
+
+// Returns the number of records read, or -1 if they are out of order.
+static long consume(RtTest *t) {
+  TinyPipe *const q = &t->pipe;
+  long numRead = 0;
+  long last = -1;
+  for (;;) {
+    if (!tpipe_hasData(q)) {
+      if (__atomic_load_n(&t->finished, __ATOMIC_ACQUIRE) && !tpipe_hasData(q)) return numRead;
+      sched_yield();
+      continue;
+    }
+    int numBytes = 0;
+    const char *const buffer = tpipe_getReadBuffer(q, &numBytes);
+    long i;
+    memcpy(&i, buffer, sizeof(i));
+    if ((i <= last) || (numBytes != recordBytes(i))) return -1;
+    tpipe_consume(q);
+    last = i;
+    ++numRead;
+    if ((numRead % 10007) == 0) tpipe_requestReset(q);
+#if TPIPE_ENABLE_STATS
+    if ((numRead % 1009) == 0) {
+      TinyPipeStats stats;
+      tpipe_getStats(q, &stats);
+      if (tpipe_getRecommendedSize(q) <= 0) return -1;
+    }
+#endif
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static RtTest t;
+  t.numRecords = (argc > 1) ? atol(argv[1]) : 1000000;
+  tpipe_init(&t.pipe, 4 * MAX_RECORD_BYTES);
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, produce, &t);
+  __atomic_store_n(&armed, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&t.started, 1, __ATOMIC_RELEASE);
+  const long numRead = consume(&t);
+  __atomic_store_n(&armed, 0, __ATOMIC_RELEASE);
+  pthread_join(producer, NULL);
+  tpipe_free(&t.pipe);
+
+  long numCalls = 0;
+  for (int c = 0; c < NUM_CALLS; ++c) {
+    if (calls[c] > 0) printf("%ld calls to %s\n", calls[c], callNames[c]);
+    numCalls += calls[c];
+  }
+  if ((numRead < 0) || (numCalls > 0)) {
+    printf("FAILED: %ld records read, %ld calls\n", numRead, numCalls);
+    return 1;
+  }
+  printf("%ld of %ld records read, no allocations or system calls: ok\n", numRead, t.numRecords);
+  return 0;
+}
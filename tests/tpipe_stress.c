@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// Runs a producer and a consumer thread over a small pipe, checking the order and
+// contents of every record. Besides plain records, the producer can resize the
+// pipe as it goes, the consumer can request resets, or the consumer can release
+// idle memory. Build it with ThreadSanitizer and atomics to check the memory
+// ordering of each; it also runs without them.
+//
+// cc -O1 -g -pthread -fsanitize=thread -DTPIPE_USE_ATOMICS=1 -I.. tpipe_stress.c ../tinypipe.c -o tpipe_stress
+// ./tpipe_stress [records|resize|reset|idle] [number of records]
+
+#define _DEFAULT_SOURCE // for rand_r() in strict C modes
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinypipe.h"
+
+typedef enum StressMode {
+  STRESS_RECORDS,
+  STRESS_RESIZE,
+  STRESS_RESET,
+  STRESS_IDLE,
+  STRESS_NUM_MODES
+} StressMode;
+
+static const char *modeNames[STRESS_NUM_MODES] = {"records", "resize", "reset", "idle"};
+
+typedef struct Stress {
+  TinyPipe pipe;
+  StressMode mode;
+  long numRecords;
+  int done; // set by the producer after its last record
+} Stress;
+
+// Records are between 8 and 607 bytes long and start with their sequence number.
+// The rest of the record is filled with a pattern derived from it.
+static int recordBytes(long i) {
+  return 8 + (int) ((unsigned long) i * 7919ul % 600ul);
+}
+
+static char patternAt(long i, int k) {
+  return (char) (i + k);
+}
+
+static void *produce(void *arg) {
+  Stress *const s = (Stress *) arg;
+  unsigned int seed = 1;
+  for (long i = 0; i < s->numRecords;) {
+    if ((s->mode == STRESS_RESIZE) && ((i % 5000) == 4999)) {
+      const int numBytes = 2048 + (rand_r(&seed) % 65536);
+      while (tpipe_resize(&s->pipe, numBytes) == 0) sched_yield();
+    }
+    const int numBytes = recordBytes(i);
+    char *const buffer = tpipe_getWriteBuffer(&s->pipe, numBytes);
+    if (buffer == NULL) {
+      sched_yield(); // the pipe is full
+      continue;
+    }
+    memcpy(buffer, &i, sizeof(i));
+    for (int k = (int) sizeof(i); k < numBytes; ++k) buffer[k] = patternAt(i, k);
+    tpipe_produce(&s->pipe, numBytes);
+    ++i;
+  }
+  __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Returns the number of records read, or -1 if a record is out of order or corrupt.
+static long consume(Stress *s) {
+  TinyPipe *const q = &s->pipe;
+  unsigned int seed = 2;
+  long numRead = 0;
+  long last = -1;
+  for (;;) {
+    if (!tpipe_hasData(q)) {
+      if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE) && !tpipe_hasData(q)) {
+        return numRead; // everything has been read or discarded
+      }
+      sched_yield();
+      continue;
+    }
+    int numBytes = 0;
+    const char *const buffer = tpipe_getReadBuffer(q, &numBytes);
+    long i;
+    memcpy(&i, buffer, sizeof(i));
+    if ((s->mode == STRESS_RESET) ? (i <= last) : (i != (last + 1))) {
+      printf("record %ld read after %ld\n", i, last);
+      return -1;
+    }
+    if (numBytes != recordBytes(i)) {
+      printf("record %ld is %d bytes long\n", i, numBytes);
+      return -1;
+    }
+    for (int k = (int) sizeof(i); k < numBytes; ++k) {
+      if (buffer[k] != patternAt(i, k)) {
+        printf("record %ld is corrupt at byte %d\n", i, k);
+        return -1;
+      }
+    }
+    tpipe_consume(q);
+    last = i;
+    ++numRead;
+    if ((s->mode == STRESS_RESET) && ((rand_r(&seed) % 5000) == 0)) tpipe_requestReset(q);
+  }
+}
+
+static int run(StressMode mode, long numRecords) {
+  Stress s;
+  tpipe_init(&s.pipe, (mode == STRESS_IDLE) ? (1 << 20) : 8192);
+  if (mode == STRESS_IDLE) tpipe_setIdleRelease(&s.pipe, 8192);
+  s.mode = mode;
+  s.numRecords = numRecords;
+  s.done = 0;
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, produce, &s);
+  const long numRead = consume(&s);
+  pthread_join(producer, NULL);
+  tpipe_free(&s.pipe);
+
+  if (numRead < 0) {
+    printf("%-8s FAILED\n", modeNames[mode]);
+    return 1;
+  }
+  if ((mode != STRESS_RESET) && (numRead != numRecords)) {
+    printf("%-8s FAILED: %ld of %ld records read\n", modeNames[mode], numRead, numRecords);
+    return 1;
+  }
+  printf("%-8s %ld of %ld records read: ok\n", modeNames[mode], numRead, numRecords);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const long numRecords = (argc > 2) ? atol(argv[2]) : 300000;
+  int failures = 0;
+  for (int m = 0; m < STRESS_NUM_MODES; ++m) {
+    if ((argc > 1) && (strcmp(argv[1], modeNames[m]) != 0)) continue;
+    failures += run((StressMode) m, numRecords);
+  }
+  return (failures == 0) ? 0 : 1;
+}
@@ -14,13 +14,23 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _DEFAULT_SOURCE // for madvise() and clock_gettime() in strict C modes
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "tinypipe.h"
 
-#if __SSE__
+#if defined(hv_sfence)
+  // supplied by the includer
+#elif TPIPE_SINGLE_THREADED
+  // the producer and consumer are the same thread, no ordering is required
+  #define hv_sfence()
+#elif TPIPE_USE_ATOMICS
+  // ordering is given by the release stores below
+  #define hv_sfence()
+#elif __SSE__
   #include <xmmintrin.h>
   #define hv_sfence() _mm_sfence()
 #elif __arm__
@@ -40,10 +50,106 @@
   #define hv_sfence() __asm__ volatile("" : : : "memory")
 #endif
 
+#if __GNUC__
+  #define hv_prefetch(a, rw) __builtin_prefetch((a), (rw))
+  #define TPIPE_NOINLINE __attribute__((noinline, cold))
+#else
+  #define hv_prefetch(a, rw)
+  #define TPIPE_NOINLINE
+#endif
+
+#ifndef TPIPE_PREFETCH_DISTANCE
+  // how far ahead, in bytes, the producer and consumer prefetch. 0 disables prefetching.
+  #define TPIPE_PREFETCH_DISTANCE 256
+#endif
+
+// releasing idle memory makes a system call, so it is left out of the real-time profile
+#if (__unix__ || __APPLE__) && !TPIPE_RT_SAFE
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #if TPIPE_USE_MADV_FREE && defined(MADV_FREE)
+    // pages are only reclaimed under memory pressure, which is cheaper but
+    // does not immediately reduce the resident set size
+    #define TPIPE_MADV_RELEASE MADV_FREE
+  #else
+    #define TPIPE_MADV_RELEASE MADV_DONTNEED
+  #endif
+#endif
+
+#if (__x86_64__ || __i386__) && __SSE2__ && __GNUC__
+  #include <emmintrin.h>
+  #include <immintrin.h>
+  #define TPIPE_HAS_STREAMING_COPY 1
+#endif
+
+#if TPIPE_ENABLE_USDT
+  // static tracepoints for bpftrace and other USDT tools (see tools/). These
+  // compile to a nop when no tracer is attached.
+  #include <sys/sdt.h>
+  #define tpipe_probe2(name, a, b) DTRACE_PROBE2(tinypipe, name, a, b)
+  #define tpipe_probe3(name, a, b, c) DTRACE_PROBE3(tinypipe, name, a, b, c)
+#else
+  #define tpipe_probe2(name, a, b)
+  #define tpipe_probe3(name, a, b, c)
+#endif
+
+#ifndef TPIPE_STREAMING_COPY_BYTES
+  // records at least this long are copied with non-temporal stores, bypassing
+  // the producer's cache
+  #define TPIPE_STREAMING_COPY_BYTES (512 * 1024)
+#endif
+
+#if TPIPE_ENABLE_TIMESTAMPS
+  #if TPIPE_TIMESTAMP_USE_TSC && (__x86_64__ || __i386__) && __GNUC__
+    #include <x86intrin.h>
+    // latencies are measured in TSC ticks. This assumes an invariant TSC which is
+    // synchronised across cores.
+    #define tpipe_getTimestamp() ((uint64_t) __rdtsc())
+  #else
+    #include <time.h>
+    // latencies are measured in nanoseconds
+    static inline uint64_t tpipe_getTimestamp(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+    }
+  #endif
+#endif
+
 #define HLP_STOP 0
 #define HLP_LOOP -1
-#define TPIPE_SET_INT32_AT_BUFFER(a, b) (*((int32_t *) (a)) = (b))
-#define TPIPE_GET_INT32_AT_BUFFER(a) (*((int32_t *) (a)))
+#define HLP_FORWARD -2
+#define TPIPE_AUTOTUNE_MIN_BYTES 4096
+// The producer owns buffer, len, writeHead and the record headers. The consumer
+// owns readHead, releaseHead and resetGeneration. The pipe relies on three
+// orderings between them:
+//  1. A record header, loop marker or forward marker is written after the record,
+//     the stop marker following it and any forwarding address. Reading the header
+//     makes all of these visible to the consumer.
+//  2. The consumer advances its read (or release) head after it has finished with
+//     the records before it. Reading the head hands that space back to the
+//     producer, which may then overwrite it.
+//  3. writeGeneration is written after resetBuffer and resetHead.
+// On x86, 1 and 3 are ordered with hv_sfence() by default, and 2 relies on the
+// processor not reordering loads with later stores. Other processors, such as ARM,
+// do reorder them, so there TPIPE_USE_ATOMICS defaults to 1, expressing all three
+// with C11-style release stores and acquire loads. These need no fences on x86
+// either, and let the protocol be checked with ThreadSanitizer or a C11 model
+// checker. A test harness may define
+// tpipe_load(), tpipe_store() and hv_sfence() itself to schedule every access and
+// model the store buffers (see tests/).
+#if defined(tpipe_load) && defined(tpipe_store)
+  // supplied by the includer
+#elif TPIPE_USE_ATOMICS && !TPIPE_SINGLE_THREADED
+  #define tpipe_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+  #define tpipe_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+  #define tpipe_load(p) (*(p))
+  #define tpipe_store(p, v) (*(p) = (v))
+#endif
+
+#define TPIPE_SET_INT32_AT_BUFFER(a, b) tpipe_store((int32_t *) (a), (int32_t) (b))
+#define TPIPE_GET_INT32_AT_BUFFER(a) tpipe_load((int32_t *) (a))
 
 int tpipe_init(TinyPipe *q, int numBytes) {
   assert(numBytes > 0);
@@ -53,62 +159,322 @@ int tpipe_init(TinyPipe *q, int numBytes) {
   q->readHead = q->buffer;
   q->len = numBytes;
   q->remainingBytes = numBytes;
+  q->readBuffer = q->buffer;
+  q->releaseBuffer = NULL;
+  q->releaseUserData = NULL;
+  q->releaseHead = q->buffer;
+  q->releaseBytes = 0;
+  q->resetGeneration = 0;
+  q->writeGeneration = 0;
+  q->readGeneration = 0;
+  q->resetBuffer = q->buffer;
+  q->resetHead = q->buffer;
+#if TPIPE_ENABLE_STATS
+  memset(&q->producerStats, 0, sizeof(TinyPipeProducerStats));
+  memset(&q->consumerStats, 0, sizeof(TinyPipeConsumerStats));
+#endif
+#if TPIPE_ENABLE_TIMESTAMPS
+  tpipe_histogramClear(&q->latency);
+#endif
   TPIPE_SET_INT32_AT_BUFFER(q->buffer, HLP_STOP);
   return numBytes;
 }
 
+// Moves the read head from a forwarding record to the start of the new buffer
+// and releases the old one.
+static void tpipe_followForward(TinyPipe *q) {
+  char *const oldBuffer = q->readBuffer;
+  char *newBuffer = NULL;
+  memcpy(&newBuffer, q->readHead + sizeof(int32_t), sizeof(newBuffer));
+  q->readBuffer = newBuffer;
+  tpipe_store(&q->readHead, newBuffer);
+  tpipe_store(&q->releaseHead, newBuffer);
+  if (q->releaseBuffer != NULL) q->releaseBuffer(oldBuffer, q->releaseUserData);
+  else free(oldBuffer);
+}
+
+// Discards records until the read head has followed all forwards up to the given
+// buffer. This should be done when only one thread is accessing the pipe.
+static void tpipe_dropUntilBuffer(TinyPipe *q, char *buffer) {
+  while (q->readBuffer != buffer) {
+    const int32_t d = TPIPE_GET_INT32_AT_BUFFER(q->readHead);
+    assert(d != HLP_STOP);
+    if (d == HLP_FORWARD) tpipe_followForward(q);
+    else if (d == HLP_LOOP) tpipe_store(&q->readHead, q->readBuffer);
+    else tpipe_store(&q->readHead, q->readHead + TPIPE_HEADER_BYTES + d);
+  }
+}
+
+// Returns the read head as seen from the producer's current buffer. If the
+// consumer has not yet followed all forwards, it will resume reading at the start
+// of the producer's buffer.
+static char *tpipe_getProducerReadHead(TinyPipe *q) {
+  char *const readHead = (q->releaseBytes > 0) ? tpipe_load(&q->releaseHead) : tpipe_load(&q->readHead);
+  if ((readHead < q->buffer) || (readHead >= (q->buffer + q->len))) return q->buffer;
+  return readHead;
+}
+
+// Hands the drained bytes from the release head up to the given end back to the
+// producer. If enough bytes have been drained, the whole pages among them are first
+// returned to the kernel. This is safe because the producer does not write beyond
+// the release head.
+static void tpipe_releaseDrained(TinyPipe *q, char *end) {
+#ifdef TPIPE_MADV_RELEASE
+  char *const start = q->releaseHead;
+  if ((end - start) >= q->releaseBytes) {
+    // don't release pages which the producer is about to write to. If the
+    // producer is on another buffer, it won't write to this one again.
+    int32_t producerBytes = INT32_MAX;
+    if (q->readBuffer == tpipe_load(&q->buffer)) {
+      producerBytes = (int32_t) (start - tpipe_load(&q->writeHead));
+      if (producerBytes < 0) producerBytes += tpipe_load(&q->len);
+    }
+    if (producerBytes >= q->releaseBytes) {
+      const uintptr_t pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+      const uintptr_t a = ((uintptr_t) start + pageSize - 1) & ~(pageSize - 1);
+      const uintptr_t b = ((uintptr_t) end) & ~(pageSize - 1);
+      if (a < b) madvise((void *) a, b - a, TPIPE_MADV_RELEASE);
+    }
+  }
+#endif
+  tpipe_store(&q->releaseHead, end);
+}
+
+// Indicates that a reservation has failed. Always returns NULL.
+static char *tpipe_rejectWrite(TinyPipe *q, int bytesToWrite) {
+  tpipe_probe2(full, q, bytesToWrite);
+#if TPIPE_ENABLE_STATS
+  q->producerStats.failedReservations++;
+#endif
+  (void) q;
+  (void) bytesToWrite;
+  return NULL;
+}
+
 void tpipe_free(TinyPipe *q) {
+  tpipe_dropUntilBuffer(q, q->buffer);
   free(q->buffer);
 }
 
+#if !TPIPE_RT_SAFE
+void tpipe_setReleaseCallback(TinyPipe *q,
+    void (*releaseBuffer)(char *buffer, void *userData), void *userData) {
+  q->releaseBuffer = releaseBuffer;
+  q->releaseUserData = userData;
+}
+
+int tpipe_setIdleRelease(TinyPipe *q, int numBytes) {
+  assert(numBytes >= 0);
+#ifdef TPIPE_MADV_RELEASE
+  q->releaseHead = q->readHead;
+  q->releaseBytes = numBytes;
+  return numBytes;
+#else
+  return 0;
+#endif
+}
+
+int tpipe_resize(TinyPipe *q, int numBytes) {
+  assert(numBytes > 0);
+
+  // reserve space for the forwarding address after the marker, looping around if
+  // necessary. The address also occupies the space otherwise reserved for the
+  // rest of the record header and the stop marker.
+  const int forwardBytes = (int) sizeof(char *) - TPIPE_HEADER_BYTES;
+  if (tpipe_getWriteBuffer(q, (forwardBytes > 0) ? forwardBytes : 0) == NULL) return 0;
+  char *const oldWriteHead = q->writeHead;
+
+  char *const buffer = (char *) malloc(numBytes);
+  assert(buffer != NULL);
+  TPIPE_SET_INT32_AT_BUFFER(buffer, HLP_STOP);
+  memcpy(oldWriteHead + sizeof(int32_t), &buffer, sizeof(buffer));
+  tpipe_store(&q->buffer, buffer);
+  tpipe_store(&q->writeHead, buffer);
+  tpipe_store(&q->len, numBytes);
+  q->remainingBytes = numBytes;
+
+  // save the new buffer and forwarding address to memory
+  hv_sfence();
+
+  // then publish the forward
+  TPIPE_SET_INT32_AT_BUFFER(oldWriteHead, HLP_FORWARD);
+  return numBytes;
+}
+#endif
+
+#if TPIPE_ENABLE_STATS
+int tpipe_getRecommendedSize(TinyPipe *q) {
+  const int32_t len = q->len;
+
+  // grow if the pipe has been full
+  const TinyPipeProducerStats *const stats = &q->producerStats;
+  if (stats->failedReservations > stats->tunedFailedReservations) return (len <= (INT32_MAX / 2)) ? (2 * len) : len;
+
+  // otherwise keep twice the high water mark, to absorb the bytes wasted at the
+  // end of the buffer when looping around
+  int32_t numBytes = TPIPE_AUTOTUNE_MIN_BYTES;
+  while ((numBytes / 2) < stats->highWaterMark) {
+    if (numBytes > (INT32_MAX / 2)) return len; // can't grow any further
+    numBytes *= 2;
+  }
+
+  // only shrink if the pipe is substantially oversized
+  return (numBytes <= (len / 4)) ? numBytes : len;
+}
+#endif
+
+#if TPIPE_ENABLE_STATS && !TPIPE_RT_SAFE
+int tpipe_autoTune(TinyPipe *q) {
+  const int numBytes = tpipe_getRecommendedSize(q);
+  if (numBytes == q->len) return 0;
+
+  // a failure to reserve the forwarding record should not count towards growing
+  TinyPipeProducerStats *const stats = &q->producerStats;
+  const uint64_t failedReservations = stats->failedReservations;
+  const int success = tpipe_resize(q, numBytes);
+  stats->failedReservations = failedReservations;
+  if (success == 0) return 0;
+  stats->tunedFailedReservations = failedReservations;
+  stats->highWaterMark = 0;
+  return numBytes;
+}
+#endif
+
+#if TPIPE_ENABLE_STATS
+void tpipe_getStats(TinyPipe *q, TinyPipeStats *stats) {
+  const TinyPipeProducerStats *const p = &q->producerStats;
+  const TinyPipeConsumerStats *const c = &q->consumerStats;
+  stats->producedRecords = p->producedRecords;
+  stats->producedBytes = p->producedBytes;
+  stats->consumedRecords = c->consumedRecords;
+  stats->consumedBytes = c->consumedBytes;
+  stats->failedReservations = p->failedReservations;
+  stats->loops = p->loops;
+  stats->wastedWrapBytes = p->wastedWrapBytes;
+  stats->highWaterMark = p->highWaterMark;
+  stats->len = q->len;
+}
+#endif
+
+// Kept out of line: resets are rare, and inlining it merged the hot path's loads of buffer and writeHead.
+static TPIPE_NOINLINE void tpipe_acknowledgeReset(TinyPipe *q) {
+  const uint32_t resetGeneration = tpipe_load(&q->resetGeneration);
+  q->resetBuffer = q->buffer;
+  q->resetHead = q->writeHead;
+
+  // save the reset position to memory
+  hv_sfence();
+
+  // then acknowledge the reset
+  tpipe_store(&q->writeGeneration, resetGeneration);
+}
+
+// Moves the read head to the position published by the producer when it
+// acknowledged the requested reset. Returns 0 if the producer has not yet done so.
+static int tpipe_completeReset(TinyPipe *q) {
+  const uint32_t resetGeneration = q->resetGeneration;
+  if (tpipe_load(&q->writeGeneration) != resetGeneration) return 0;
+  tpipe_dropUntilBuffer(q, q->resetBuffer);
+  tpipe_store(&q->readHead, q->resetHead);
+  tpipe_store(&q->releaseHead, q->resetHead);
+  q->readGeneration = resetGeneration;
+  return 1;
+}
+
 int tpipe_hasData(TinyPipe *q) {
+  if ((q->readGeneration != q->resetGeneration) && !tpipe_completeReset(q)) return 0;
+
   int x = TPIPE_GET_INT32_AT_BUFFER(q->readHead);
-  if (x == HLP_LOOP) {
-    q->readHead = q->buffer;
+  while (x < 0) {
+    if (x == HLP_LOOP) {
+      if (q->releaseBytes > 0) tpipe_releaseDrained(q, q->readHead);
+      tpipe_store(&q->readHead, q->readBuffer);
+      tpipe_store(&q->releaseHead, q->readBuffer);
+    } else {
+      tpipe_followForward(q); // HLP_FORWARD
+    }
     x = TPIPE_GET_INT32_AT_BUFFER(q->readHead);
   }
+
+  // don't hold back drained bytes from the producer while the pipe is empty
+  if ((x == HLP_STOP) && (q->releaseHead != q->readHead) && (q->releaseBytes > 0)) {
+    tpipe_releaseDrained(q, q->readHead);
+  }
   return x;
 }
 
 char *tpipe_getWriteBuffer(TinyPipe *q, int bytesToWrite) {
-  char *const readHead = q->readHead;
+  if (q->writeGeneration != tpipe_load(&q->resetGeneration)) tpipe_acknowledgeReset(q);
+
+  char *const readHead = tpipe_getProducerReadHead(q);
   char *const oldWriteHead = q->writeHead;
-  const int totalByteRequirement = bytesToWrite + 2 * sizeof(int32_t);
+  const int totalByteRequirement = TPIPE_HEADER_BYTES + bytesToWrite + (int) sizeof(int32_t);
 
   // check if there is enough space to write the data in the remaining
   // length of the buffer
   if (totalByteRequirement <= q->remainingBytes) {
-    char *const newWriteHead = oldWriteHead + sizeof(int32_t) + bytesToWrite;
+    char *const newWriteHead = oldWriteHead + TPIPE_HEADER_BYTES + bytesToWrite;
 
     // check if writing would overwrite existing data in the pipe (return NULL if so)
-    if ((oldWriteHead < readHead) && (newWriteHead >= readHead)) return NULL;
-    else return (oldWriteHead + sizeof(int32_t));
+    // (the stop marker written at the new write head must also fit before the read head)
+    if ((oldWriteHead < readHead) && ((newWriteHead + sizeof(int32_t)) > readHead)) return tpipe_rejectWrite(q, bytesToWrite);
+    else return (oldWriteHead + TPIPE_HEADER_BYTES);
   } else {
     // there isn't enough space, try looping around to the start
     if (totalByteRequirement <= q->len) {
       if ((oldWriteHead < readHead) || ((q->buffer + totalByteRequirement) > readHead)) {
-        return NULL; // overwrite condition
+        return tpipe_rejectWrite(q, bytesToWrite); // overwrite condition
       } else {
-        q->writeHead = q->buffer;
+#if TPIPE_ENABLE_STATS
+        q->producerStats.loops++;
+        q->producerStats.wastedWrapBytes += q->remainingBytes;
+#endif
+        tpipe_probe2(loop, q, q->remainingBytes);
+        tpipe_store(&q->writeHead, q->buffer);
         q->remainingBytes = q->len;
         TPIPE_SET_INT32_AT_BUFFER(q->buffer, HLP_STOP);
         hv_sfence();
         TPIPE_SET_INT32_AT_BUFFER(oldWriteHead, HLP_LOOP);
-        return q->buffer + sizeof(int32_t);
+        return q->buffer + TPIPE_HEADER_BYTES;
       }
     } else {
-      return NULL; // there isn't enough space to write the data
+      return tpipe_rejectWrite(q, bytesToWrite); // there isn't enough space to write the data
     }
   }
 }
 
 void tpipe_produce(TinyPipe *q, int numBytes) {
-  assert(q->remainingBytes >= (numBytes + (int) (2*sizeof(int32_t))));
-  q->remainingBytes -= (sizeof(int32_t) + numBytes);
+  assert(q->remainingBytes >= (TPIPE_HEADER_BYTES + numBytes + (int) sizeof(int32_t)));
+  q->remainingBytes -= (TPIPE_HEADER_BYTES + numBytes);
   char *const oldWriteHead = q->writeHead;
-  q->writeHead += (sizeof(int32_t) + numBytes);
+  tpipe_store(&q->writeHead, oldWriteHead + TPIPE_HEADER_BYTES + numBytes);
   TPIPE_SET_INT32_AT_BUFFER(q->writeHead, HLP_STOP);
 
+#if TPIPE_ENABLE_TIMESTAMPS
+  const uint64_t timestamp = tpipe_getTimestamp();
+  memcpy(oldWriteHead + sizeof(int32_t), &timestamp, sizeof(timestamp));
+#endif
+
+#if TPIPE_ENABLE_STATS
+  TinyPipeProducerStats *const stats = &q->producerStats;
+  stats->producedRecords++;
+  stats->producedBytes += numBytes;
+  int32_t usedBytes = (int32_t) (q->writeHead - tpipe_getProducerReadHead(q));
+  if (usedBytes < 0) usedBytes += q->len;
+  if (usedBytes > stats->highWaterMark) stats->highWaterMark = usedBytes;
+#endif
+
+#if TPIPE_PREFETCH_DISTANCE > 0
+  // prepare the area of the next reservations for writing
+  if (q->remainingBytes > TPIPE_PREFETCH_DISTANCE) {
+    hv_prefetch(q->writeHead + TPIPE_PREFETCH_DISTANCE, 1);
+  }
+#endif
+
+  // fire the probe before publishing the record, so that a tracer always sees it
+  // produced before it is consumed
+  tpipe_probe3(produce, q, oldWriteHead, numBytes);
+
   // save everything before this point to memory
   hv_sfence();
 
@@ -118,41 +484,163 @@ void tpipe_produce(TinyPipe *q, int numBytes) {
 
 char *tpipe_getReadBuffer(TinyPipe *q, int *numBytes) {
   *numBytes = TPIPE_GET_INT32_AT_BUFFER(q->readHead);
-  char *const readBuffer = q->readHead + sizeof(int32_t);
+  char *const readBuffer = q->readHead + TPIPE_HEADER_BYTES;
+
+#if TPIPE_PREFETCH_DISTANCE > 0
+  // fetch the next record's header and the records beyond it, which are
+  // likely still in the producer's cache
+  char *const nextHead = readBuffer + *numBytes;
+  hv_prefetch(nextHead, 0);
+  hv_prefetch(nextHead + TPIPE_PREFETCH_DISTANCE, 0);
+#endif
   return readBuffer;
 }
 
 void tpipe_consume(TinyPipe *q) {
-  assert(TPIPE_GET_INT32_AT_BUFFER(q->readHead) != HLP_STOP);
-  q->readHead += sizeof(int32_t) + TPIPE_GET_INT32_AT_BUFFER(q->readHead);
+  const int32_t numBytes = TPIPE_GET_INT32_AT_BUFFER(q->readHead);
+  assert(numBytes != HLP_STOP);
+  tpipe_probe3(consume, q, q->readHead, numBytes);
+#if TPIPE_ENABLE_TIMESTAMPS
+  uint64_t timestamp;
+  memcpy(&timestamp, q->readHead + sizeof(int32_t), sizeof(timestamp));
+  const uint64_t now = tpipe_getTimestamp();
+  tpipe_histogramRecord(&q->latency, (now > timestamp) ? (now - timestamp) : 0);
+#endif
+  tpipe_store(&q->readHead, q->readHead + TPIPE_HEADER_BYTES + numBytes);
+#if TPIPE_ENABLE_STATS
+  q->consumerStats.consumedRecords++;
+  q->consumerStats.consumedBytes += numBytes;
+#endif
+  if ((q->releaseBytes > 0) && ((q->readHead - q->releaseHead) >= q->releaseBytes)) {
+    tpipe_releaseDrained(q, q->readHead);
+  }
 }
 
 void tpipe_clear(TinyPipe *q) {
+  tpipe_dropUntilBuffer(q, q->buffer);
   q->writeHead = q->buffer;
   q->readHead = q->buffer;
+  q->releaseHead = q->buffer;
   q->remainingBytes = q->len;
-  memset(q->buffer, 0, q->len);
+  q->writeGeneration = q->resetGeneration;
+  q->readGeneration = q->resetGeneration;
+
+  // the consumer never reads beyond a stop marker, so the rest of the buffer
+  // does not need to be cleared
+  TPIPE_SET_INT32_AT_BUFFER(q->buffer, HLP_STOP);
+}
+
+void tpipe_requestReset(TinyPipe *q) {
+  tpipe_store(&q->resetGeneration, q->resetGeneration + 1);
 }
 
+#if !TPIPE_RT_SAFE
 int tpipe_getTotalData(TinyPipe *q) {
+  if (q->readGeneration != q->resetGeneration) return 0; // the data is being discarded
+
+  char *buffer = q->readBuffer;
   char *p = q->readHead;
   int len = 0;
   int d = 0;
   while ((d = TPIPE_GET_INT32_AT_BUFFER(p)) != HLP_STOP) {
     if (d == HLP_LOOP) {
-      p = q->buffer;
+      p = buffer;
+    } else if (d == HLP_FORWARD) {
+      memcpy(&buffer, p + sizeof(int32_t), sizeof(buffer));
+      p = buffer;
     } else {
       len += d;
-      p += (sizeof(int32_t) + d);
+      p += (TPIPE_HEADER_BYTES + d);
     }
   }
   return len;
 }
+#endif
+
+// Copies short records with a few fixed-size, possibly overlapping, moves.
+static inline void tpipe_copySmall(char *dst, const char *src, int numBytes) {
+  if (numBytes >= 16) {
+    memcpy(dst, src, 16);
+    memcpy(dst + numBytes - 16, src + numBytes - 16, 16);
+  } else if (numBytes >= 8) {
+    memcpy(dst, src, 8);
+    memcpy(dst + numBytes - 8, src + numBytes - 8, 8);
+  } else if (numBytes >= 4) {
+    memcpy(dst, src, 4);
+    memcpy(dst + numBytes - 4, src + numBytes - 4, 4);
+  } else if (numBytes > 0) {
+    dst[0] = src[0];
+    dst[numBytes / 2] = src[numBytes / 2];
+    dst[numBytes - 1] = src[numBytes - 1];
+  }
+}
+
+#if TPIPE_HAS_STREAMING_COPY
+// Copies long records with non-temporal stores. These are weakly ordered, but the
+// sfence in tpipe_produce() makes them visible before the record is published.
+// Release stores do not order them, so they are fenced here when using atomics.
+#if TPIPE_USE_ATOMICS && !TPIPE_SINGLE_THREADED
+  #define tpipe_streamingFence() _mm_sfence()
+#else
+  #define tpipe_streamingFence()
+#endif
+
+static void tpipe_copyStreamingSse2(char *dst, const char *src, int numBytes) {
+  const int head = (int) ((16 - ((uintptr_t) dst & 15)) & 15);
+  memcpy(dst, src, head);
+  int i = head;
+  for (; i <= (numBytes - 64); i += 64) {
+    const __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *) (src + i + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i *) (src + i + 32));
+    const __m128i d = _mm_loadu_si128((const __m128i *) (src + i + 48));
+    _mm_stream_si128((__m128i *) (dst + i), a);
+    _mm_stream_si128((__m128i *) (dst + i + 16), b);
+    _mm_stream_si128((__m128i *) (dst + i + 32), c);
+    _mm_stream_si128((__m128i *) (dst + i + 48), d);
+  }
+  memcpy(dst + i, src + i, numBytes - i);
+  tpipe_streamingFence();
+}
+
+__attribute__((target("avx2")))
+static void tpipe_copyStreamingAvx2(char *dst, const char *src, int numBytes) {
+  const int head = (int) ((32 - ((uintptr_t) dst & 31)) & 31);
+  memcpy(dst, src, head);
+  int i = head;
+  for (; i <= (numBytes - 128); i += 128) {
+    const __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+    const __m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+    const __m256i c = _mm256_loadu_si256((const __m256i *) (src + i + 64));
+    const __m256i d = _mm256_loadu_si256((const __m256i *) (src + i + 96));
+    _mm256_stream_si256((__m256i *) (dst + i), a);
+    _mm256_stream_si256((__m256i *) (dst + i + 32), b);
+    _mm256_stream_si256((__m256i *) (dst + i + 64), c);
+    _mm256_stream_si256((__m256i *) (dst + i + 96), d);
+  }
+  memcpy(dst + i, src + i, numBytes - i);
+  tpipe_streamingFence();
+}
+#endif
+
+// Copies a record into the pipe, choosing a strategy based on its length.
+static void tpipe_copy(char *dst, const char *src, int numBytes) {
+  if (numBytes <= 32) {
+    tpipe_copySmall(dst, src, numBytes);
+#if TPIPE_HAS_STREAMING_COPY
+  } else if (numBytes >= TPIPE_STREAMING_COPY_BYTES) {
+    if (__builtin_cpu_supports("avx2")) tpipe_copyStreamingAvx2(dst, src, numBytes);
+    else tpipe_copyStreamingSse2(dst, src, numBytes);
+#endif
+  } else {
+    memcpy(dst, src, numBytes);
+  }
+}
 
 int tpipe_write(TinyPipe *q, char *data, int numBytes) {
   char *buffer = tpipe_getWriteBuffer(q, numBytes);
   if (buffer == NULL) return 0;
-  memcpy(buffer, data, numBytes);
+  tpipe_copy(buffer, data, numBytes);
   tpipe_produce(q, numBytes);
   return 1;
 }
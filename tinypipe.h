@@ -21,24 +21,128 @@
 
 #include <stdint.h>
 
+#ifndef TPIPE_SINGLE_THREADED
+#define TPIPE_SINGLE_THREADED 0 // set to 1 if the producer and consumer are the same thread
+#endif
+
+#ifndef TPIPE_USE_ATOMICS
+#if __GNUC__ && !(__x86_64__ || __i386__)
+#define TPIPE_USE_ATOMICS 1 // other processors may reorder loads with later stores, see tinypipe.c
+#else
+#define TPIPE_USE_ATOMICS 0 // set to 1 to order the pipe with release stores and acquire loads
+#endif
+#endif
+
+#ifndef TPIPE_ENABLE_STATS
+#define TPIPE_ENABLE_STATS 0 // set to 1 to record occupancy statistics and enable auto-tuning
+#endif
+
+#ifndef TPIPE_ENABLE_TIMESTAMPS
+#define TPIPE_ENABLE_TIMESTAMPS 0 // set to 1 to record the latency of each record
+#endif
+
+#ifndef TPIPE_RT_SAFE
+#define TPIPE_RT_SAFE 0 // set to 1 to expose only functions which are bounded and make no system calls
+#endif
+
+#if TPIPE_ENABLE_TIMESTAMPS
+#include "tinypipe_histogram.h"
+#endif
+
+// Fields written by different threads are separated by this much padding, so that
+// they never share a cache line. Padding is used rather than alignment, which
+// would require pipes to be allocated with aligned_alloc().
+#define TPIPE_CACHE_LINE_BYTES 64
+
+// Each record starts with its length, followed by the time at which it was
+// produced if timestamps are enabled. Once tpipe_hasData() has returned the length
+// of a record, the consumer may read it directly at readHead + TPIPE_HEADER_BYTES.
+#if TPIPE_ENABLE_TIMESTAMPS
+#define TPIPE_HEADER_BYTES ((int) (sizeof(int32_t) + sizeof(uint64_t)))
+#else
+#define TPIPE_HEADER_BYTES ((int) sizeof(int32_t))
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#if TPIPE_ENABLE_STATS
+  /*
+   * Statistics written only by the producer thread. Counters are never reset.
+   */
+  typedef struct TinyPipeProducerStats {
+    uint64_t producedRecords;
+    uint64_t producedBytes;
+    uint64_t failedReservations; // calls to tpipe_getWriteBuffer() which returned NULL
+    uint64_t loops; // times the write head looped around to the start of the buffer
+    uint64_t wastedWrapBytes; // bytes left unused at the end of the buffer when looping around
+    int32_t highWaterMark; // the greatest number of bytes in use since the last auto-tune
+    uint64_t tunedFailedReservations; // failed reservations at the last auto-tune
+  } TinyPipeProducerStats;
+
+  /*
+   * Statistics written only by the consumer thread.
+   */
+  typedef struct TinyPipeConsumerStats {
+    uint64_t consumedRecords;
+    uint64_t consumedBytes;
+  } TinyPipeConsumerStats;
+
+  /*
+   * A snapshot of the statistics of a pipe (see tpipe_getStats()).
+   */
+  typedef struct TinyPipeStats {
+    uint64_t producedRecords;
+    uint64_t producedBytes;
+    uint64_t consumedRecords;
+    uint64_t consumedBytes;
+    uint64_t failedReservations;
+    uint64_t loops;
+    uint64_t wastedWrapBytes;
+    int32_t highWaterMark;
+    int32_t len; // the size of the pipe in bytes
+  } TinyPipeStats;
+#endif
+
   /*
    * This pipe assumes that there is only one producer thread and one consumer
    * thread. This data structure does not support any other configuration.
+   * If both are the same thread, define TPIPE_SINGLE_THREADED to remove all
+   * memory ordering.
    */
   typedef struct TinyPipe {
-    char *buffer;
+    char *buffer; // the buffer currently being written to
     char *writeHead;
     char *readHead;
     int32_t len;
     int32_t remainingBytes; // total bytes from write head to end
+    char *readBuffer; // the buffer currently being read from
+    void (*releaseBuffer)(char *buffer, void *userData);
+    void *releaseUserData;
+    char *releaseHead; // start of the drained bytes not yet returned to the producer
+    int32_t releaseBytes; // drained bytes after which pages are released, or 0 if disabled
+    uint32_t resetGeneration; // incremented by the consumer to request a reset
+    uint32_t writeGeneration; // the last reset generation acknowledged by the producer
+    uint32_t readGeneration; // the reset generation the consumer is reading
+    char *resetBuffer; // the buffer the producer was writing to when acknowledging a reset
+    char *resetHead; // the write head when the producer acknowledged a reset
+#if TPIPE_ENABLE_STATS || TPIPE_ENABLE_TIMESTAMPS
+    char pad0[TPIPE_CACHE_LINE_BYTES];
+#endif
+#if TPIPE_ENABLE_STATS
+    TinyPipeProducerStats producerStats;
+    char pad1[TPIPE_CACHE_LINE_BYTES];
+    TinyPipeConsumerStats consumerStats;
+#endif
+#if TPIPE_ENABLE_TIMESTAMPS
+    TinyPipeHistogram latency; // from tpipe_produce() to tpipe_consume(), written by the consumer
+#endif
   } TinyPipe;
 
   /**
-   * Initialise the pipe with a given length, in bytes.
+   * Initialise the pipe with a given length, in bytes. This allocates the buffer,
+   * so it should not be called from a real-time thread.
    *
    * @param q  The pipe.
    *
@@ -47,12 +151,104 @@ extern "C" {
   int tpipe_init(TinyPipe *q, int numBytes);
 
   /**
-   * Frees the internal buffer.
+   * Frees the internal buffer. This should not be called from a real-time thread.
    *
    * @param q  The light pipe.
    */
   void tpipe_free(TinyPipe *q);
 
+#if !TPIPE_RT_SAFE
+  /**
+   * Sets the function which is called on the consumer thread to release an old
+   * buffer once it has been fully drained after a call to tpipe_resize(). The
+   * callback takes ownership of the buffer and must eventually free() it. If no
+   * callback is set, the buffer is freed directly. This should be done before
+   * the producer and consumer threads are started.
+   *
+   * @param q  The pipe.
+   * @param releaseBuffer  The release callback, or NULL.
+   * @param userData  A pointer passed through to the callback.
+   */
+  void tpipe_setReleaseCallback(TinyPipe *q,
+      void (*releaseBuffer)(char *buffer, void *userData), void *userData);
+
+  /**
+   * Changes the capacity of the pipe while it is in use. This function must be
+   * called from the producer thread. New data is written to a newly allocated
+   * buffer, and a forwarding record is left in the old one. Data already in the
+   * pipe is not lost: the consumer reads it out of the old buffer, follows the
+   * forward and releases the old buffer (see tpipe_setReleaseCallback()).
+   *
+   * @param q  The pipe.
+   * @param numBytes  The new size of the pipe in bytes.
+   *
+   * @return  Returns the new size of the pipe in bytes. Returns 0 if there is
+   *          currently no space to write the forwarding record. Successive calls
+   *          to this function may eventually succeed because the readhead has
+   *          been advanced on another thread.
+   */
+  int tpipe_resize(TinyPipe *q, int numBytes);
+
+  /**
+   * Enables returning the memory of drained regions of the buffer to the kernel.
+   * The consumer holds back up to numBytes of drained bytes from the producer. Once
+   * that many have accumulated, or the pipe becomes empty, the whole pages among
+   * them are released with madvise() before they are handed back. Pages are not
+   * released while the producer is close behind the consumer, as they would
+   * immediately be faulted in again. This should be done before the producer and
+   * consumer threads are started.
+   *
+   * @param q  The pipe.
+   * @param numBytes  The minimum number of drained bytes to release at once, or 0
+   *                  to disable. This should be a multiple of the page size and
+   *                  well below the size of the pipe.
+   *
+   * @return  Returns numBytes, or 0 if the platform does not support releasing memory.
+   */
+  int tpipe_setIdleRelease(TinyPipe *q, int numBytes);
+#endif
+
+#if TPIPE_ENABLE_STATS
+  /**
+   * Returns a recommended size for the pipe based on its occupancy statistics.
+   * The pipe should grow if any reservations have failed. It should shrink if the
+   * high water mark stays well below the current size.
+   *
+   * @param q  The pipe.
+   *
+   * @return  The recommended size of the pipe in bytes. This is the current size
+   *          if no change is recommended.
+   */
+  int tpipe_getRecommendedSize(TinyPipe *q);
+#endif
+
+#if TPIPE_ENABLE_STATS && !TPIPE_RT_SAFE
+  /**
+   * Resizes the pipe to its recommended size (see tpipe_getRecommendedSize()) and
+   * resets its statistics. This function must be called from the producer thread,
+   * e.g. periodically or after a failed call to tpipe_getWriteBuffer().
+   *
+   * @param q  The pipe.
+   *
+   * @return  Returns the new size of the pipe in bytes. Returns 0 if the size has
+   *          not changed.
+   */
+  int tpipe_autoTune(TinyPipe *q);
+#endif
+
+#if TPIPE_ENABLE_STATS
+  /**
+   * Takes a snapshot of the statistics of the pipe. This function may be called
+   * from any thread. The counters are read without synchronisation, so they are
+   * not consistent with each other while the pipe is in use, and 64-bit counters
+   * may be torn on 32-bit platforms.
+   *
+   * @param q  The pipe.
+   * @param stats  The snapshot to fill.
+   */
+  void tpipe_getStats(TinyPipe *q, TinyPipeStats *stats);
+#endif
+
   /**
    * Indicates if data is available for reading.
    *
@@ -104,11 +300,28 @@ extern "C" {
 
   /**
    * Resets the queue to the initialised state. This should be done when only one thread is accessing the pipe.
+   * This takes constant time, regardless of the size of the pipe, unless the
+   * consumer has not yet drained an old buffer after tpipe_resize(). The records
+   * left in old buffers are then walked to find and release them.
    *
    * @param q  The pipe.
    */
   void tpipe_clear(TinyPipe *q);
 
+  /**
+   * Requests that all data currently in the pipe is discarded. This function must
+   * be called from the consumer thread while the producer may be running. The
+   * pipe appears empty to the consumer until the producer's next call to
+   * tpipe_getWriteBuffer(), after which only data written from then on is read.
+   * This takes constant time, regardless of the amount of data in the pipe, unless
+   * the reset spans a tpipe_resize(), in which case the records left in the old
+   * buffers are walked to release them.
+   *
+   * @param q  The pipe.
+   */
+  void tpipe_requestReset(TinyPipe *q);
+
+#if !TPIPE_RT_SAFE
   /**
    * Returns the total amount of data that is currently in the pipe.
    *
@@ -117,6 +330,7 @@ extern "C" {
    * @return  The number of bytes ready to be read from the pipe.
    */
   int tpipe_getTotalData(TinyPipe *q);
+#endif
 
   /**
    * A convenience function to write a number of bytes to the pipe;
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+
+#include "tinypipe_channel.h"
+
+// Each record starts with its channel number, so that records of every channel
+// can share the pipe's framing.
+#define TPIPE_CHANNEL_BYTES ((int) sizeof(int32_t))
+
+char *tpipe_getChannelWriteBuffer(TinyPipe *q, int channel, int numBytes) {
+  assert((channel >= 0) && (channel < TPIPE_MAX_CHANNELS));
+  char *const buffer = tpipe_getWriteBuffer(q, TPIPE_CHANNEL_BYTES + numBytes);
+  if (buffer == NULL) return NULL;
+  const int32_t c = channel;
+  memcpy(buffer, &c, sizeof(c));
+  return buffer + TPIPE_CHANNEL_BYTES;
+}
+
+void tpipe_produceChannel(TinyPipe *q, int numBytes) {
+  tpipe_produce(q, TPIPE_CHANNEL_BYTES + numBytes);
+}
+
+int tpipe_writeChannel(TinyPipe *q, int channel, const char *data, int numBytes) {
+  char *const buffer = tpipe_getChannelWriteBuffer(q, channel, numBytes);
+  if (buffer == NULL) return 0;
+  memcpy(buffer, data, numBytes);
+  tpipe_produceChannel(q, numBytes);
+  return 1;
+}
+
+void tpipe_demuxInit(TinyPipeDemux *d) {
+  memset(d, 0, sizeof(TinyPipeDemux));
+}
+
+void tpipe_demuxRegister(TinyPipeDemux *d, int channel,
+    TinyPipeChannelHandler handler, void *userData) {
+  assert((channel >= 0) && (channel < TPIPE_MAX_CHANNELS));
+  d->channels[channel].handler = handler;
+  d->channels[channel].userData = userData;
+}
+
+int tpipe_demuxDispatch(TinyPipe *q, TinyPipeDemux *d, int maxRecords) {
+  int numRecords = 0;
+  while ((numRecords < maxRecords) && tpipe_hasData(q)) {
+    int len = 0;
+    const char *const buffer = tpipe_getReadBuffer(q, &len);
+    assert(len >= TPIPE_CHANNEL_BYTES);
+    int32_t channel = 0;
+    memcpy(&channel, buffer, sizeof(channel));
+    assert((channel >= 0) && (channel < TPIPE_MAX_CHANNELS));
+
+    const TinyPipeChannelHandler handler = d->channels[channel].handler;
+    if (handler != NULL) {
+      handler(channel, buffer + TPIPE_CHANNEL_BYTES, len - TPIPE_CHANNEL_BYTES,
+          d->channels[channel].userData);
+    } else {
+      d->droppedRecords++;
+    }
+    tpipe_consume(q);
+    ++numRecords;
+  }
+  return numRecords;
+}
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_CHANNEL_H_
+#define _TINYPIPE_CHANNEL_H_
+
+#include "tinypipe.h"
+
+#ifndef TPIPE_MAX_CHANNELS
+#define TPIPE_MAX_CHANNELS 64 // the number of logical channels in one pipe
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * Called on the consumer thread for each record of a channel. The data is only
+   * valid until the handler returns.
+   */
+  typedef void (*TinyPipeChannelHandler)(int channel, const char *data, int numBytes, void *userData);
+
+  /*
+   * The consumer's table of handlers, indexed by channel. Records of many logical
+   * streams share one pipe, each prefixed with its channel number.
+   */
+  typedef struct TinyPipeDemux {
+    struct {
+      TinyPipeChannelHandler handler;
+      void *userData;
+    } channels[TPIPE_MAX_CHANNELS];
+    uint64_t droppedRecords; // records of channels without a handler
+  } TinyPipeDemux;
+
+  /**
+   * Returns a pointer to a location in the pipe where numBytes of a record of the
+   * given channel can be written. This function must be called from the producer
+   * thread.
+   *
+   * @param q  The pipe.
+   * @param channel  The channel, from 0 to TPIPE_MAX_CHANNELS - 1.
+   * @param numBytes  The number of bytes to be written.
+   *
+   * @return  A pointer to a location where those bytes can be written. Returns
+   *          NULL if no more space is available.
+   */
+  char *tpipe_getChannelWriteBuffer(TinyPipe *q, int channel, int numBytes);
+
+  /**
+   * Indicates to the pipe how many bytes of a channel record have been written.
+   *
+   * @param q  The pipe.
+   * @param numBytes  The number of bytes written, excluding the channel number.
+   */
+  void tpipe_produceChannel(TinyPipe *q, int numBytes);
+
+  /**
+   * A convenience function to write a record of the given channel to the pipe.
+   * Records of a channel may be empty.
+   *
+   * @param q  The pipe.
+   * @param channel  The channel, from 0 to TPIPE_MAX_CHANNELS - 1.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the pipe. 0 otherwise.
+   */
+  int tpipe_writeChannel(TinyPipe *q, int channel, const char *data, int numBytes);
+
+  /**
+   * Initialises a table of handlers with none registered.
+   *
+   * @param d  The handler table.
+   */
+  void tpipe_demuxInit(TinyPipeDemux *d);
+
+  /**
+   * Sets the handler of a channel. This should be done before the producer and
+   * consumer threads are started, or on the consumer thread.
+   *
+   * @param d  The handler table.
+   * @param channel  The channel, from 0 to TPIPE_MAX_CHANNELS - 1.
+   * @param handler  The handler, or NULL to drop the records of the channel.
+   * @param userData  A pointer passed through to the handler.
+   */
+  void tpipe_demuxRegister(TinyPipeDemux *d, int channel,
+      TinyPipeChannelHandler handler, void *userData);
+
+  /**
+   * Reads up to maxRecords records of all channels from the pipe in one pass,
+   * passing each to the handler of its channel and consuming it. Records of
+   * channels without a handler are counted and dropped. All records in the pipe
+   * must have been written with the channel functions. This function must be
+   * called from the consumer thread.
+   *
+   * @param q  The pipe.
+   * @param d  The handler table.
+   * @param maxRecords  The maximum number of records to read.
+   *
+   * @return  The number of records read.
+   */
+  int tpipe_demuxDispatch(TinyPipe *q, TinyPipeDemux *d, int maxRecords);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_CHANNEL_H_
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_CRC_H_
+#define _TINYPIPE_CRC_H_
+
+#include "tinypipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * Writes a number of bytes to the pipe, followed by their CRC32C checksum. The
+   * checksum is computed while the data is copied. Records written with this
+   * function must be read with tpipe_getCheckedReadBuffer().
+   *
+   * @param q  The pipe.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the pipe. 0 otherwise.
+   */
+  int tpipe_writeChecked(TinyPipe *q, const char *data, int numBytes);
+
+  /**
+   * Returns the current read buffer of a record written with tpipe_writeChecked(),
+   * after verifying its checksum. The record must still be consumed with
+   * tpipe_consume(), whether or not it is valid.
+   *
+   * @param q  The pipe.
+   * @param numBytes  This value will be filled with the number of bytes available
+   *                  for reading, excluding the checksum.
+   *
+   * @return  A pointer to the read buffer, or NULL if the record is corrupt.
+   */
+  char *tpipe_getCheckedReadBuffer(TinyPipe *q, int *numBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_CRC_H_
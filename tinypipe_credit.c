@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+
+#include "tinypipe_credit.h"
+
+// A grant record holds the number of bytes and of records granted back.
+typedef struct TinyPipeGrant {
+  int32_t bytes;
+  int32_t messages;
+} TinyPipeGrant;
+
+int tpipe_creditInit(TinyPipeCredit *c, int numBytes, int creditBytes, int creditMessages) {
+  assert((creditBytes > 0) && (creditMessages > 0));
+  tpipe_init(&c->grants, TPIPE_CREDIT_GRANT_BYTES);
+  c->producer.bytes = creditBytes;
+  c->producer.messages = creditMessages;
+  c->consumer.pendingBytes = 0;
+  c->consumer.pendingMessages = 0;
+  c->consumer.grantBytes = (creditBytes > 4) ? (creditBytes / 4) : 1;
+  c->consumer.grantMessages = (creditMessages > 4) ? (creditMessages / 4) : 1;
+  return tpipe_init(&c->data, numBytes);
+}
+
+void tpipe_creditFree(TinyPipeCredit *c) {
+  tpipe_free(&c->data);
+  tpipe_free(&c->grants);
+}
+
+int64_t tpipe_creditCollect(TinyPipeCredit *c) {
+  while (tpipe_hasData(&c->grants)) {
+    int len = 0;
+    TinyPipeGrant grant;
+    memcpy(&grant, tpipe_getReadBuffer(&c->grants, &len), sizeof(grant));
+    assert(len == (int) sizeof(grant));
+    c->producer.bytes += grant.bytes;
+    c->producer.messages += grant.messages;
+    tpipe_consume(&c->grants);
+  }
+  return c->producer.bytes;
+}
+
+char *tpipe_creditGetWriteBuffer(TinyPipeCredit *c, int numBytes) {
+  // only look for new grants when the current credit runs out
+  TinyPipeCreditProducer *const p = &c->producer;
+  if ((p->bytes < numBytes) || (p->messages < 1)) {
+    tpipe_creditCollect(c);
+    if ((p->bytes < numBytes) || (p->messages < 1)) return NULL;
+  }
+  return tpipe_getWriteBuffer(&c->data, numBytes);
+}
+
+void tpipe_creditProduce(TinyPipeCredit *c, int numBytes) {
+  c->producer.bytes -= numBytes;
+  c->producer.messages--;
+  tpipe_produce(&c->data, numBytes);
+}
+
+int tpipe_creditWrite(TinyPipeCredit *c, const char *data, int numBytes) {
+  char *const buffer = tpipe_creditGetWriteBuffer(c, numBytes);
+  if (buffer == NULL) return 0;
+  memcpy(buffer, data, numBytes);
+  tpipe_creditProduce(c, numBytes);
+  return 1;
+}
+
+void tpipe_creditConsume(TinyPipeCredit *c) {
+  int len = 0;
+  tpipe_getReadBuffer(&c->data, &len);
+  tpipe_consume(&c->data);
+
+  TinyPipeCreditConsumer *const s = &c->consumer;
+  s->pendingBytes += len;
+  s->pendingMessages++;
+  if ((s->pendingBytes >= s->grantBytes) || (s->pendingMessages >= s->grantMessages)) {
+    tpipe_creditFlush(c);
+  }
+}
+
+int tpipe_creditFlush(TinyPipeCredit *c) {
+  TinyPipeCreditConsumer *const s = &c->consumer;
+  if (s->pendingMessages == 0) return 1;
+  const TinyPipeGrant grant = {s->pendingBytes, s->pendingMessages};
+  if (!tpipe_write(&c->grants, (char *) &grant, sizeof(grant))) return 0;
+  s->pendingBytes = 0;
+  s->pendingMessages = 0;
+  return 1;
+}
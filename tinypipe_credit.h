@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_CREDIT_H_
+#define _TINYPIPE_CREDIT_H_
+
+#include "tinypipe.h"
+
+#ifndef TPIPE_CREDIT_GRANT_BYTES
+#define TPIPE_CREDIT_GRANT_BYTES 1024 // the size of the pipe carrying grants back to the producer
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * The producer's side of the flow control.
+   */
+  typedef struct TinyPipeCreditProducer {
+    int64_t bytes; // the number of bytes the producer may still write
+    int64_t messages; // the number of records the producer may still write
+  } TinyPipeCreditProducer;
+
+  /*
+   * The consumer's side of the flow control.
+   */
+  typedef struct TinyPipeCreditConsumer {
+    int32_t pendingBytes; // consumed bytes not yet granted back to the producer
+    int32_t pendingMessages; // consumed records not yet granted back to the producer
+    int32_t grantBytes; // pending bytes after which a grant is sent
+    int32_t grantMessages; // pending records after which a grant is sent
+  } TinyPipeCreditConsumer;
+
+  /*
+   * A pipe with credit-based flow control. The producer starts with a number of
+   * byte and record credits, and spends them as it writes. The consumer grants
+   * them back through a second pipe once it has consumed the records. A producer
+   * without credit sees this before reserving space in the pipe, so it can
+   * throttle or batch its writes instead of retrying in a loop.
+   */
+  typedef struct TinyPipeCredit {
+    TinyPipe data; // records from the producer to the consumer
+    TinyPipe grants; // credits from the consumer back to the producer
+    char pad0[TPIPE_CACHE_LINE_BYTES];
+    TinyPipeCreditProducer producer;
+    char pad1[TPIPE_CACHE_LINE_BYTES];
+    TinyPipeCreditConsumer consumer;
+  } TinyPipeCredit;
+
+  /**
+   * Initialises the pipe and gives the producer its initial credits. The consumer
+   * grants credits back in batches of a quarter of them.
+   *
+   * @param c  The pipe.
+   * @param numBytes  The size of the data pipe in bytes.
+   * @param creditBytes  The number of bytes of data which may be in the pipe. This
+   *                     should leave room for the record headers and the bytes
+   *                     wasted when looping around the buffer, which can be as many
+   *                     as the longest record, e.g. half of numBytes.
+   * @param creditMessages  The number of records which may be in the pipe.
+   *
+   * @return  Returns the size of the data pipe in bytes.
+   */
+  int tpipe_creditInit(TinyPipeCredit *c, int numBytes, int creditBytes, int creditMessages);
+
+  /**
+   * Frees the pipe.
+   *
+   * @param c  The pipe.
+   */
+  void tpipe_creditFree(TinyPipeCredit *c);
+
+  /**
+   * Collects the credits granted by the consumer. This function must be called
+   * from the producer thread.
+   *
+   * @param c  The pipe.
+   *
+   * @return  The number of bytes which the producer may write.
+   */
+  int64_t tpipe_creditCollect(TinyPipeCredit *c);
+
+  /**
+   * Returns a pointer to a location in the pipe where numBytes can be written,
+   * if the producer has the credit for one more record of that length. This
+   * function must be called from the producer thread.
+   *
+   * @param c  The pipe.
+   * @param numBytes  The number of bytes to be written.
+   *
+   * @return  A pointer to a location where those bytes can be written. Returns
+   *          NULL if the producer is out of credit or the pipe is full.
+   */
+  char *tpipe_creditGetWriteBuffer(TinyPipeCredit *c, int numBytes);
+
+  /**
+   * Indicates to the pipe how many bytes have been written, and spends their credit.
+   *
+   * @param c  The pipe.
+   * @param numBytes  The number of bytes written.
+   */
+  void tpipe_creditProduce(TinyPipeCredit *c, int numBytes);
+
+  /**
+   * A convenience function to write a number of bytes to the pipe.
+   *
+   * @param c  The pipe.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the pipe. 0 otherwise.
+   */
+  int tpipe_creditWrite(TinyPipeCredit *c, const char *data, int numBytes);
+
+  /**
+   * Consumes the current record of the data pipe, which is read with
+   * tpipe_hasData() and tpipe_getReadBuffer() on c->data, and grants its credit
+   * back to the producer once enough has accumulated. In a pipeline, a stage
+   * should only consume its input once it has written its output, so that a
+   * slow stage holds back the credit of all stages before it. This function
+   * must be called from the consumer thread.
+   *
+   * @param c  The pipe.
+   */
+  void tpipe_creditConsume(TinyPipeCredit *c);
+
+  /**
+   * Grants all consumed but not yet granted credit back to the producer. Call it
+   * whenever the pipe is empty: a record longer than three quarters of the credit
+   * may need the credit which is held back, and would otherwise never be written.
+   * This function must be called from the consumer thread.
+   *
+   * @param c  The pipe.
+   *
+   * @return 1 if the credit was granted or none was pending. 0 if the grant pipe
+   *         is full, in which case the credit stays pending.
+   */
+  int tpipe_creditFlush(TinyPipeCredit *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_CREDIT_H_
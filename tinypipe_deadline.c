@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+
+#include "tinypipe_deadline.h"
+
+// Each record starts with its deadline, directly after the record header, so that
+// both are usually on the same cache line.
+#define TPIPE_DEADLINE_BYTES ((int) sizeof(uint64_t))
+
+char *tpipe_getDeadlineWriteBuffer(TinyPipe *q, uint64_t deadline, int numBytes) {
+  char *const buffer = tpipe_getWriteBuffer(q, TPIPE_DEADLINE_BYTES + numBytes);
+  if (buffer == NULL) return NULL;
+  memcpy(buffer, &deadline, sizeof(deadline));
+  return buffer + TPIPE_DEADLINE_BYTES;
+}
+
+void tpipe_produceDeadline(TinyPipe *q, int numBytes) {
+  tpipe_produce(q, TPIPE_DEADLINE_BYTES + numBytes);
+}
+
+int tpipe_writeDeadline(TinyPipe *q, uint64_t deadline, const char *data, int numBytes) {
+  char *const buffer = tpipe_getDeadlineWriteBuffer(q, deadline, numBytes);
+  if (buffer == NULL) return 0;
+  memcpy(buffer, data, numBytes);
+  tpipe_produceDeadline(q, numBytes);
+  return 1;
+}
+
+int tpipe_skipExpired(TinyPipe *q, uint64_t now) {
+  int numExpired = 0;
+  int len = 0;
+  while ((len = tpipe_hasData(q)) > 0) {
+    // read the deadline in place, as tpipe_getReadBuffer() would prefetch the
+    // records after it
+    uint64_t deadline = 0;
+    assert(len >= TPIPE_DEADLINE_BYTES);
+    memcpy(&deadline, q->readHead + TPIPE_HEADER_BYTES, sizeof(deadline));
+    if (deadline >= now) break;
+    tpipe_consume(q);
+    ++numExpired;
+  }
+  return numExpired;
+}
+
+char *tpipe_getDeadlineReadBuffer(TinyPipe *q, int *numBytes, uint64_t *deadline) {
+  int len = 0;
+  char *const buffer = tpipe_getReadBuffer(q, &len);
+  assert(len >= TPIPE_DEADLINE_BYTES);
+  if (deadline != NULL) memcpy(deadline, buffer, sizeof(*deadline));
+  *numBytes = len - TPIPE_DEADLINE_BYTES;
+  return buffer + TPIPE_DEADLINE_BYTES;
+}
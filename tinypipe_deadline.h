@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_DEADLINE_H_
+#define _TINYPIPE_DEADLINE_H_
+
+#include "tinypipe.h"
+
+#define TPIPE_NO_DEADLINE UINT64_MAX // a deadline for records which never expire
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * Records written with these functions carry a deadline in front of their data.
+   * Deadlines and the current time may be in any unit of a monotonic clock, e.g.
+   * nanoseconds of CLOCK_MONOTONIC or TSC ticks, as long as the producer and
+   * consumer agree on it.
+   */
+
+  /**
+   * Returns a pointer to a location in the pipe where numBytes of a record with
+   * the given deadline can be written. This function must be called from the
+   * producer thread.
+   *
+   * @param q  The pipe.
+   * @param deadline  The time after which the record is useless, or TPIPE_NO_DEADLINE.
+   * @param numBytes  The number of bytes to be written.
+   *
+   * @return  A pointer to a location where those bytes can be written. Returns
+   *          NULL if no more space is available.
+   */
+  char *tpipe_getDeadlineWriteBuffer(TinyPipe *q, uint64_t deadline, int numBytes);
+
+  /**
+   * Indicates to the pipe how many bytes of a record with a deadline have been
+   * written.
+   *
+   * @param q  The pipe.
+   * @param numBytes  The number of bytes written, excluding the deadline.
+   */
+  void tpipe_produceDeadline(TinyPipe *q, int numBytes);
+
+  /**
+   * A convenience function to write a record with a deadline to the pipe.
+   *
+   * @param q  The pipe.
+   * @param deadline  The time after which the record is useless, or TPIPE_NO_DEADLINE.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the pipe. 0 otherwise.
+   */
+  int tpipe_writeDeadline(TinyPipe *q, uint64_t deadline, const char *data, int numBytes);
+
+  /**
+   * Consumes records whose deadline is before the given time, up to the first
+   * record which has not expired. Only the header and deadline of each record are
+   * read, and nothing is prefetched, so recovering from a backlog does not load
+   * the expired data into the cache. This function must be called from the consumer thread.
+   *
+   * @param q  The pipe.
+   * @param now  The current time.
+   *
+   * @return  The number of expired records which were consumed.
+   */
+  int tpipe_skipExpired(TinyPipe *q, uint64_t now);
+
+  /**
+   * Returns the current read buffer of a record written with a deadline. The
+   * record must still be consumed with tpipe_consume().
+   *
+   * @param q  The pipe.
+   * @param numBytes  This value will be filled with the number of bytes available
+   *                  for reading, excluding the deadline.
+   * @param deadline  This value will be filled with the deadline of the record.
+   *                  May be NULL.
+   *
+   * @return  A pointer to the read buffer.
+   */
+  char *tpipe_getDeadlineReadBuffer(TinyPipe *q, int *numBytes, uint64_t *deadline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_DEADLINE_H_
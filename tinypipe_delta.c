@@ -0,0 +1,247 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinypipe_delta.h"
+
+// define TPIPE_DELTA_SCALAR=1 to decode without SSSE3 on x86, e.g. to test the
+// portable decoder
+#if (__x86_64__ || __i386__) && __GNUC__ && !TPIPE_DELTA_SCALAR
+  #include <tmmintrin.h>
+  #define TPIPE_HAS_SSSE3_DECODE 1
+#endif
+
+// An encoded record starts with one control byte for every four words. Each holds
+// a 2-bit code per word, lowest bits first, giving the number of bytes stored for
+// the word. These bytes follow the control bytes, little-endian. Only the low bytes
+// of a value are stored, so the exclusive or of a float is byte-swapped first if
+// its zeros are expected in its low bytes rather than its high bytes. Slowly
+// varying readings share their sign, exponent and high mantissa bits with the
+// previous record, and are stored as they are. Readings in steps of a power of
+// two, e.g. quantised by an ADC, differ only in a few high mantissa bits and are
+// swapped. The direction of each word follows its last non-zero exclusive or, so
+// the encoder and decoder agree on it without storing it.
+static const int tpipe_deltaCodeBytes[4] = {0, 1, 2, 4};
+
+static inline uint32_t tpipe_deltaToLittleEndian(uint32_t x) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_bswap32(x);
+#else
+  return x;
+#endif
+}
+
+static inline uint32_t tpipe_deltaZigZag(uint32_t x) {
+  return (x << 1) ^ (uint32_t) -(int32_t) (x >> 31);
+}
+
+static inline uint32_t tpipe_deltaUnZigZag(uint32_t x) {
+  return (x >> 1) ^ (uint32_t) -(int32_t) (x & 1);
+}
+
+// Returns the swap mask for the next exclusive or of a float word, given the
+// current mask and exclusive or: swapped if its low 16 bits were zero.
+static inline uint32_t tpipe_deltaNextSwapMask(uint32_t swapMask, uint32_t x) {
+  // computed without branches, as the exclusive ors of noisy words are unpredictable
+  const uint32_t unchanged = -(uint32_t) (x == 0);
+  const uint32_t swapNext = -(uint32_t) ((x & 0xFFFF) == 0);
+  return (unchanged & swapMask) | (~unchanged & swapNext);
+}
+
+// Byte-swaps a value if the swap mask is set. Swapping is its own inverse.
+static inline uint32_t tpipe_deltaOrder(uint32_t x, uint32_t swapMask) {
+  return (__builtin_bswap32(x) & swapMask) | (x & ~swapMask);
+}
+
+static inline int tpipe_deltaGetMaxBytes(int numWords) {
+  return ((numWords + 3) / 4) + (4 * numWords);
+}
+
+#if TPIPE_HAS_SSSE3_DECODE
+// The shuffles which move the stored bytes of a group of four words, given its
+// control byte, into place, and the number of bytes stored for the group. Both are
+// constant, so that streams can be initialised on any thread.
+#define TPIPE_DELTA_LEN(c, k) ((((c) >> (2 * (k))) & 3) == 3 ? 4 : (((c) >> (2 * (k))) & 3))
+#define TPIPE_DELTA_OFFSET(c, k) (((k) > 0 ? TPIPE_DELTA_LEN(c, 0) : 0) \
+    + ((k) > 1 ? TPIPE_DELTA_LEN(c, 1) : 0) + ((k) > 2 ? TPIPE_DELTA_LEN(c, 2) : 0) \
+    + ((k) > 3 ? TPIPE_DELTA_LEN(c, 3) : 0))
+#define TPIPE_DELTA_BYTE(c, k, j) \
+    ((j) < TPIPE_DELTA_LEN(c, k) ? (TPIPE_DELTA_OFFSET(c, k) + (j)) : 0x80)
+#define TPIPE_DELTA_WORD(c, k) TPIPE_DELTA_BYTE(c, k, 0), TPIPE_DELTA_BYTE(c, k, 1), \
+    TPIPE_DELTA_BYTE(c, k, 2), TPIPE_DELTA_BYTE(c, k, 3)
+#define TPIPE_DELTA_SHUFFLE(c) \
+    {TPIPE_DELTA_WORD(c, 0), TPIPE_DELTA_WORD(c, 1), TPIPE_DELTA_WORD(c, 2), TPIPE_DELTA_WORD(c, 3)}
+#define TPIPE_DELTA_GROUP(c) TPIPE_DELTA_OFFSET(c, 4)
+#define TPIPE_DELTA_X4(f, c) f(c), f((c) + 1), f((c) + 2), f((c) + 3)
+#define TPIPE_DELTA_X16(f, c) TPIPE_DELTA_X4(f, c), TPIPE_DELTA_X4(f, (c) + 4), \
+    TPIPE_DELTA_X4(f, (c) + 8), TPIPE_DELTA_X4(f, (c) + 12)
+#define TPIPE_DELTA_X64(f, c) TPIPE_DELTA_X16(f, c), TPIPE_DELTA_X16(f, (c) + 16), \
+    TPIPE_DELTA_X16(f, (c) + 32), TPIPE_DELTA_X16(f, (c) + 48)
+#define TPIPE_DELTA_X256(f) TPIPE_DELTA_X64(f, 0), TPIPE_DELTA_X64(f, 64), \
+    TPIPE_DELTA_X64(f, 128), TPIPE_DELTA_X64(f, 192)
+
+static const uint8_t tpipe_deltaShuffles[256][16] = {TPIPE_DELTA_X256(TPIPE_DELTA_SHUFFLE)};
+static const uint8_t tpipe_deltaGroupBytes[256] = {TPIPE_DELTA_X256(TPIPE_DELTA_GROUP)};
+static const uint8_t tpipe_deltaByteSwap[16] = {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12};
+#endif
+
+int tpipe_deltaInit(TinyPipeDelta *d, const char *layout) {
+  d->numWords = (int) strlen(layout);
+  assert(d->numWords > 0);
+  d->previous = (uint32_t *) calloc(d->numWords, sizeof(uint32_t));
+  d->xorMasks = (uint32_t *) malloc(d->numWords * sizeof(uint32_t));
+  d->swapMasks = (uint32_t *) calloc(d->numWords, sizeof(uint32_t));
+  assert(d->previous != NULL && d->xorMasks != NULL && d->swapMasks != NULL);
+  for (int i = 0; i < d->numWords; ++i) {
+    assert(layout[i] == 'i' || layout[i] == 'f');
+    d->xorMasks[i] = (layout[i] == 'f') ? 0xFFFFFFFF : 0;
+  }
+  return d->numWords * (int) sizeof(uint32_t);
+}
+
+void tpipe_deltaFree(TinyPipeDelta *d) {
+  free(d->previous);
+  free(d->xorMasks);
+  free(d->swapMasks);
+}
+
+int tpipe_writeDelta(TinyPipe *q, TinyPipeDelta *d, const char *record) {
+  const int numWords = d->numWords;
+  uint8_t *const buffer = (uint8_t *) tpipe_getWriteBuffer(q, tpipe_deltaGetMaxBytes(numWords));
+  if (buffer == NULL) return 0;
+
+  uint8_t *const control = buffer;
+  uint8_t *data = control + ((numWords + 3) / 4);
+  unsigned int c = 0;
+  for (int i = 0; i < numWords; ++i) {
+    uint32_t x;
+    memcpy(&x, record + (i * sizeof(uint32_t)), sizeof(x));
+    const uint32_t xorBits = x ^ d->previous[i];
+    const uint32_t v = d->xorMasks[i]
+        ? tpipe_deltaOrder(xorBits, d->swapMasks[i])
+        : tpipe_deltaZigZag(x - d->previous[i]);
+    d->swapMasks[i] = tpipe_deltaNextSwapMask(d->swapMasks[i], xorBits) & d->xorMasks[i];
+    d->previous[i] = x;
+
+    // computed without branches, as the codes of noisy words are unpredictable
+    const int code = (v != 0) + (v > 0xFF) + (v > 0xFFFF);
+    c |= (unsigned int) code << ((i & 3) * 2);
+    if (((i & 3) == 3) || (i == (numWords - 1))) {
+      control[i >> 2] = (uint8_t) c;
+      c = 0;
+    }
+    // all four bytes are stored, as the reservation leaves room for them
+    const uint32_t le = tpipe_deltaToLittleEndian(v);
+    memcpy(data, &le, sizeof(le));
+    data += tpipe_deltaCodeBytes[code];
+  }
+
+  tpipe_produce(q, (int) (data - buffer));
+  return 1;
+}
+
+// Decodes one word. Returns the number of bytes read.
+static inline int tpipe_deltaDecodeWord(TinyPipeDelta *d, int i, int code, const uint8_t *data,
+    char *record) {
+  uint32_t v = 0;
+  for (int j = 0; j < tpipe_deltaCodeBytes[code]; ++j) v |= ((uint32_t) data[j]) << (8 * j);
+  const uint32_t xorBits = tpipe_deltaOrder(v, d->swapMasks[i]);
+  const uint32_t x = d->xorMasks[i]
+      ? (xorBits ^ d->previous[i])
+      : (d->previous[i] + tpipe_deltaUnZigZag(v));
+  d->swapMasks[i] = tpipe_deltaNextSwapMask(d->swapMasks[i], xorBits) & d->xorMasks[i];
+  d->previous[i] = x;
+  memcpy(record + (i * sizeof(uint32_t)), &x, sizeof(x));
+  return tpipe_deltaCodeBytes[code];
+}
+
+#if TPIPE_HAS_SSSE3_DECODE
+// Decodes all whole groups of four words. Returns the number of words decoded.
+__attribute__((target("ssse3")))
+static int tpipe_deltaDecodeSsse3(TinyPipeDelta *d, const uint8_t *control,
+    const uint8_t **data, const uint8_t *end, char *record) {
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i low16 = _mm_set1_epi32(0xFFFF);
+  const __m128i byteSwap = _mm_loadu_si128((const __m128i *) tpipe_deltaByteSwap);
+  int i = 0;
+  for (; (i + 4) <= d->numWords; i += 4) {
+    const uint8_t c = control[i >> 2];
+    __m128i input;
+    if ((end - *data) >= 16) {
+      input = _mm_loadu_si128((const __m128i *) *data);
+    } else {
+      // don't read beyond the record, which may end at the end of the buffer
+      uint8_t tail[16] = {0};
+      memcpy(tail, *data, end - *data);
+      input = _mm_loadu_si128((const __m128i *) tail);
+    }
+    const __m128i v = _mm_shuffle_epi8(input,
+        _mm_loadu_si128((const __m128i *) tpipe_deltaShuffles[c]));
+    *data += tpipe_deltaGroupBytes[c];
+
+    const __m128i previous = _mm_loadu_si128((const __m128i *) (d->previous + i));
+    const __m128i mask = _mm_loadu_si128((const __m128i *) (d->xorMasks + i));
+    const __m128i swap = _mm_loadu_si128((const __m128i *) (d->swapMasks + i));
+    const __m128i xorBits = _mm_or_si128(_mm_and_si128(swap, _mm_shuffle_epi8(v, byteSwap)),
+        _mm_andnot_si128(swap, v));
+    const __m128i delta = _mm_xor_si128(_mm_srli_epi32(v, 1),
+        _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+    const __m128i x = _mm_or_si128(
+        _mm_and_si128(mask, _mm_xor_si128(previous, xorBits)),
+        _mm_andnot_si128(mask, _mm_add_epi32(previous, delta)));
+
+    // as tpipe_deltaNextSwapMask(), for the float words
+    const __m128i unchanged = _mm_cmpeq_epi32(xorBits, _mm_setzero_si128());
+    const __m128i swapNext = _mm_and_si128(mask,
+        _mm_cmpeq_epi32(_mm_and_si128(xorBits, low16), _mm_setzero_si128()));
+    _mm_storeu_si128((__m128i *) (d->swapMasks + i),
+        _mm_or_si128(_mm_and_si128(unchanged, swap), _mm_andnot_si128(unchanged, swapNext)));
+    _mm_storeu_si128((__m128i *) (d->previous + i), x);
+    _mm_storeu_si128((__m128i *) (record + (i * sizeof(uint32_t))), x);
+  }
+  return i;
+}
+#endif
+
+int tpipe_readDelta(TinyPipe *q, TinyPipeDelta *d, char *record) {
+  const int numWords = d->numWords;
+  int len = 0;
+  const uint8_t *const control = (const uint8_t *) tpipe_getReadBuffer(q, &len);
+  const uint8_t *const end = control + len;
+  const uint8_t *data = control + ((numWords + 3) / 4);
+
+  // check the length of the record before decoding it
+  int numBytes = (numWords + 3) / 4;
+  if (len < numBytes) return 0;
+  for (int i = 0; i < numWords; ++i) {
+    numBytes += tpipe_deltaCodeBytes[(control[i >> 2] >> ((i & 3) * 2)) & 3];
+  }
+  if (numBytes != len) return 0;
+
+  int i = 0;
+#if TPIPE_HAS_SSSE3_DECODE
+  if (__builtin_cpu_supports("ssse3")) i = tpipe_deltaDecodeSsse3(d, control, &data, end, record);
+#endif
+  for (; i < numWords; ++i) {
+    const int code = (control[i >> 2] >> ((i & 3) * 2)) & 3;
+    data += tpipe_deltaDecodeWord(d, i, code, data, record);
+  }
+  assert(data == end);
+  return 1;
+}
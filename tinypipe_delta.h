@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_DELTA_H_
+#define _TINYPIPE_DELTA_H_
+
+#include "tinypipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * The state of one end of a stream of fixed-layout records. Each 32-bit word of
+   * a record is encoded relative to the same word of the previous record: integers
+   * as a difference, floats as an exclusive or. The producer and the consumer each
+   * have their own state, and both must see every record of the stream in order.
+   */
+  typedef struct TinyPipeDelta {
+    int numWords; // the length of a record in 32-bit words
+    uint32_t *previous; // the previous record
+    uint32_t *xorMasks; // all ones for words which are encoded with exclusive or
+    uint32_t *swapMasks; // all ones for words whose next exclusive or is byte-swapped
+  } TinyPipeDelta;
+
+  /**
+   * Initialises one end of a stream of records.
+   *
+   * @param d  The stream state.
+   * @param layout  The type of each 32-bit word of a record, 'i' for an integer or
+   *                'f' for a float. The length of the string is the length of a
+   *                record in words.
+   *
+   * @return  Returns the length of a record in bytes.
+   */
+  int tpipe_deltaInit(TinyPipeDelta *d, const char *layout);
+
+  /**
+   * Frees the stream state.
+   *
+   * @param d  The stream state.
+   */
+  void tpipe_deltaFree(TinyPipeDelta *d);
+
+  /**
+   * Encodes a record relative to the previous one and writes it to the pipe.
+   * This function must be called from the producer thread.
+   *
+   * @param q  The pipe.
+   * @param d  The producer's stream state.
+   * @param record  The record to write.
+   *
+   * @return 1 if the record was successfully written to the pipe. 0 otherwise,
+   *         in which case the stream state is unchanged.
+   */
+  int tpipe_writeDelta(TinyPipe *q, TinyPipeDelta *d, const char *record);
+
+  /**
+   * Decodes the current record of the pipe. The record must still be consumed
+   * with tpipe_consume(). This function must be called from the consumer thread.
+   *
+   * @param q  The pipe.
+   * @param d  The consumer's stream state.
+   * @param record  The buffer to write the record to.
+   *
+   * @return 1 if the record was successfully decoded. 0 if it is corrupt.
+   */
+  int tpipe_readDelta(TinyPipe *q, TinyPipeDelta *d, char *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_DELTA_H_
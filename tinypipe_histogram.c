@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "tinypipe_histogram.h"
+
+#define TPIPE_HISTOGRAM_SUB_COUNT (1 << TPIPE_HISTOGRAM_SUB_BITS)
+
+// Values below TPIPE_HISTOGRAM_SUB_COUNT have their own bucket. Larger values are
+// bucketed by the position of their highest set bit and the TPIPE_HISTOGRAM_SUB_BITS
+// bits below it.
+static inline int tpipe_histogramGetIndex(uint64_t value) {
+  if (value < TPIPE_HISTOGRAM_SUB_COUNT) return (int) value;
+#if __GNUC__
+  const int e = 63 - __builtin_clzll(value);
+#else
+  int e = 63;
+  while ((value >> e) == 0) --e;
+#endif
+  const int m = (int) (value >> (e - TPIPE_HISTOGRAM_SUB_BITS)) & (TPIPE_HISTOGRAM_SUB_COUNT - 1);
+  return ((e - TPIPE_HISTOGRAM_SUB_BITS + 1) << TPIPE_HISTOGRAM_SUB_BITS) + m;
+}
+
+// Returns the largest value counted in a bucket.
+static inline uint64_t tpipe_histogramGetUpperBound(int index) {
+  if (index < TPIPE_HISTOGRAM_SUB_COUNT) return (uint64_t) index;
+  const int shift = (index >> TPIPE_HISTOGRAM_SUB_BITS) - 1;
+  const uint64_t m = (uint64_t) (TPIPE_HISTOGRAM_SUB_COUNT + (index & (TPIPE_HISTOGRAM_SUB_COUNT - 1)));
+  return (m << shift) + ((1ull << shift) - 1);
+}
+
+void tpipe_histogramClear(TinyPipeHistogram *h) {
+  memset(h, 0, sizeof(TinyPipeHistogram));
+}
+
+void tpipe_histogramRecord(TinyPipeHistogram *h, uint64_t value) {
+  h->counts[tpipe_histogramGetIndex(value)]++;
+  if (value > h->maxValue) h->maxValue = value;
+}
+
+uint64_t tpipe_histogramGetCount(const TinyPipeHistogram *h) {
+  uint64_t count = 0;
+  for (int i = 0; i < TPIPE_HISTOGRAM_NUM_BUCKETS; ++i) count += h->counts[i];
+  return count;
+}
+
+uint64_t tpipe_histogramGetPercentile(const TinyPipeHistogram *h, double percentile) {
+  // count the values once, so that concurrent recording cannot move the target
+  // beyond the last bucket
+  const uint64_t count = tpipe_histogramGetCount(h);
+  if (count == 0) return 0;
+
+  uint64_t target = (uint64_t) ((percentile / 100.0) * (double) count + 0.5);
+  if (target < 1) target = 1;
+  if (target > count) target = count;
+
+  uint64_t n = 0;
+  for (int i = 0; i < TPIPE_HISTOGRAM_NUM_BUCKETS; ++i) {
+    n += h->counts[i];
+    if (n >= target) {
+      const uint64_t value = tpipe_histogramGetUpperBound(i);
+      const uint64_t maxValue = h->maxValue;
+      return (value < maxValue) ? value : maxValue;
+    }
+  }
+  return h->maxValue;
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_HISTOGRAM_H_
+#define _TINYPIPE_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#ifndef TPIPE_HISTOGRAM_SUB_BITS
+#define TPIPE_HISTOGRAM_SUB_BITS 5 // each power of two is split into 2^5 buckets, about 3% apart
+#endif
+
+#define TPIPE_HISTOGRAM_NUM_BUCKETS ((65 - TPIPE_HISTOGRAM_SUB_BITS) << TPIPE_HISTOGRAM_SUB_BITS)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * A log-linear histogram of 64-bit values. Values below 2^TPIPE_HISTOGRAM_SUB_BITS
+   * are counted exactly, larger ones with a relative error of at most
+   * 2^-TPIPE_HISTOGRAM_SUB_BITS. The histogram is written by a single thread
+   * without atomic operations. Other threads may query it at any time, in which
+   * case the result may miss the most recently recorded values.
+   */
+  typedef struct TinyPipeHistogram {
+    uint64_t maxValue;
+    uint64_t counts[TPIPE_HISTOGRAM_NUM_BUCKETS];
+  } TinyPipeHistogram;
+
+  /**
+   * Removes all values from the histogram. This should not be done while another
+   * thread is recording values.
+   *
+   * @param h  The histogram.
+   */
+  void tpipe_histogramClear(TinyPipeHistogram *h);
+
+  /**
+   * Adds a value to the histogram.
+   *
+   * @param h  The histogram.
+   * @param value  The value to add.
+   */
+  void tpipe_histogramRecord(TinyPipeHistogram *h, uint64_t value);
+
+  /**
+   * Returns the number of values in the histogram.
+   *
+   * @param h  The histogram.
+   */
+  uint64_t tpipe_histogramGetCount(const TinyPipeHistogram *h);
+
+  /**
+   * Returns the value below or at which the given percentage of recorded values
+   * fall, rounded up to the largest value of its bucket.
+   *
+   * @param h  The histogram.
+   * @param percentile  The percentage, from 0 to 100.
+   *
+   * @return  The value at the percentile, or 0 if the histogram is empty.
+   */
+  uint64_t tpipe_histogramGetPercentile(const TinyPipeHistogram *h, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_HISTOGRAM_H_
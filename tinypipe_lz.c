@@ -0,0 +1,270 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "tinypipe_lz.h"
+
+// The compressed format is a sequence of LZ4-style sequences. Each starts with a
+// token whose high nibble is the number of literals and whose low nibble is the
+// match length minus TPIPE_LZ_MIN_MATCH. A nibble of 15 is extended by following
+// bytes, which are added until one is less than 255. The literals follow, then a
+// 2-byte little-endian match offset. The last sequence has only literals.
+
+#define TPIPE_LZ_HASH_BITS 12
+#define TPIPE_LZ_MIN_MATCH 4
+#define TPIPE_LZ_MAX_OFFSET 65535
+
+// records are prefixed with their original length, with this bit set if compressed
+#define TPIPE_LZ_COMPRESSED_FLAG 0x80000000u
+
+static inline uint32_t tpipe_lzRead32(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static inline int tpipe_lzHash(uint32_t x, int hashBits) {
+  return (int) ((x * 2654435761u) >> (32 - hashBits));
+}
+
+static inline uint8_t *tpipe_lzWriteLength(uint8_t *op, int len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t) len;
+  return op;
+}
+
+// Writes a sequence of literals followed by a match. A match length of 0 indicates
+// the last sequence. Returns NULL if the sequence does not fit.
+static uint8_t *tpipe_lzWriteSequence(uint8_t *op, const uint8_t *oend,
+    const uint8_t *literals, int numLiterals, int offset, int matchLength) {
+  if ((op + 1 + numLiterals + (numLiterals / 255) + 1 + 2 + (matchLength / 255) + 1) > oend) {
+    return NULL;
+  }
+  uint8_t *const token = op++;
+  if (numLiterals >= 15) {
+    *token = 15 << 4;
+    op = tpipe_lzWriteLength(op, numLiterals - 15);
+  } else {
+    *token = (uint8_t) (numLiterals << 4);
+  }
+  memcpy(op, literals, numLiterals);
+  op += numLiterals;
+
+  if (matchLength > 0) {
+    *op++ = (uint8_t) (offset & 0xFF);
+    *op++ = (uint8_t) (offset >> 8);
+    const int len = matchLength - TPIPE_LZ_MIN_MATCH;
+    if (len >= 15) {
+      *token |= 15;
+      op = tpipe_lzWriteLength(op, len - 15);
+    } else {
+      *token |= (uint8_t) len;
+    }
+  }
+  return op;
+}
+
+int tpipe_lzGetBound(int numBytes) {
+  return numBytes + (numBytes / 255) + 16;
+}
+
+int tpipe_lzCompress(const char *src, int numBytes, char *dst, int maxBytes) {
+  // short inputs only clear as much of the table as they can use
+  int hashBits = 8;
+  while ((hashBits < TPIPE_LZ_HASH_BITS) && ((1 << hashBits) < numBytes)) ++hashBits;
+  int32_t table[1 << TPIPE_LZ_HASH_BITS];
+  memset(table, 0xFF, sizeof(int32_t) << hashBits); // -1, no position
+
+  const uint8_t *const base = (const uint8_t *) src;
+  const uint8_t *const iend = base + numBytes;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  uint8_t *op = (uint8_t *) dst;
+  const uint8_t *const oend = op + maxBytes;
+
+  int misses = 0;
+  while ((ip + TPIPE_LZ_MIN_MATCH) <= iend) {
+    const uint32_t x = tpipe_lzRead32(ip);
+    const int h = tpipe_lzHash(x, hashBits);
+    const int32_t ref = table[h];
+    table[h] = (int32_t) (ip - base);
+
+    if ((ref >= 0) && ((ip - base - ref) <= TPIPE_LZ_MAX_OFFSET) && (tpipe_lzRead32(base + ref) == x)) {
+      const uint8_t *match = base + ref;
+      int matchLength = TPIPE_LZ_MIN_MATCH;
+      while (((ip + matchLength) < iend) && (match[matchLength] == ip[matchLength])) ++matchLength;
+
+      op = tpipe_lzWriteSequence(op, oend, anchor, (int) (ip - anchor), (int) (ip - match), matchLength);
+      if (op == NULL) return 0;
+      ip += matchLength;
+      anchor = ip;
+      misses = 0;
+    } else {
+      // move through incompressible data faster
+      ip += 1 + (misses++ >> 6);
+    }
+  }
+
+  op = tpipe_lzWriteSequence(op, oend, anchor, (int) (iend - anchor), 0, 0);
+  return (op == NULL) ? 0 : (int) (op - (uint8_t *) dst);
+}
+
+// Reads an extended length. Returns -1 if the input ends first.
+static inline int tpipe_lzReadLength(const uint8_t **ip, const uint8_t *iend) {
+  int len = 0;
+  uint8_t b;
+  do {
+    if (*ip >= iend) return -1;
+    b = *(*ip)++;
+    len += b;
+  } while (b == 255);
+  return len;
+}
+
+int tpipe_lzDecompress(const char *src, int numBytes, char *dst, int maxBytes) {
+  const uint8_t *ip = (const uint8_t *) src;
+  const uint8_t *const iend = ip + numBytes;
+  uint8_t *op = (uint8_t *) dst;
+  uint8_t *const oend = op + maxBytes;
+
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+
+    int numLiterals = token >> 4;
+    if (numLiterals == 15) {
+      const int len = tpipe_lzReadLength(&ip, iend);
+      if (len < 0) return -1;
+      numLiterals += len;
+    }
+    if (((iend - ip) >= 16) && ((oend - op) >= 16) && (numLiterals <= 16)) {
+      memcpy(op, ip, 16); // short literals are copied with one fixed-size move
+    } else {
+      if (((iend - ip) < numLiterals) || ((oend - op) < numLiterals)) return -1;
+      memcpy(op, ip, numLiterals);
+    }
+    ip += numLiterals;
+    op += numLiterals;
+
+    if (ip == iend) break; // the last sequence
+
+    if ((iend - ip) < 2) return -1;
+    const int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > (op - (uint8_t *) dst))) return -1;
+
+    int matchLength = token & 15;
+    if (matchLength == 15) {
+      const int len = tpipe_lzReadLength(&ip, iend);
+      if (len < 0) return -1;
+      matchLength += len;
+    }
+    matchLength += TPIPE_LZ_MIN_MATCH;
+    if ((oend - op) < matchLength) return -1;
+
+    // matches may overlap the bytes they produce
+    const uint8_t *match = op - offset;
+    if ((offset >= 8) && ((oend - op) >= (matchLength + 8))) {
+      uint8_t *const end = op + matchLength;
+      do {
+        memcpy(op, match, 8);
+        op += 8;
+        match += 8;
+      } while (op < end);
+      op = end;
+    } else if (offset >= matchLength) {
+      memcpy(op, match, matchLength);
+      op += matchLength;
+    } else {
+      for (int i = 0; i < matchLength; ++i) *op++ = *match++;
+    }
+  }
+  return (int) (op - (uint8_t *) dst);
+}
+
+// Writes a record of the given data with the given length prefix.
+static int tpipe_lzWriteRecord(TinyPipe *q, uint32_t prefix, const char *data, int numBytes) {
+  char *const buffer = tpipe_getWriteBuffer(q, (int) sizeof(uint32_t) + numBytes);
+  if (buffer == NULL) return 0;
+  memcpy(buffer, &prefix, sizeof(prefix));
+  memcpy(buffer + sizeof(uint32_t), data, numBytes);
+  tpipe_produce(q, (int) sizeof(uint32_t) + numBytes);
+  return 1;
+}
+
+int tpipe_writeCompressed(TinyPipe *q, const char *data, int numBytes) {
+  assert(numBytes >= 0);
+  const uint32_t numBytesPrefix = (uint32_t) numBytes;
+  if (numBytes < TPIPE_COMPRESS_MIN_BYTES) return tpipe_lzWriteRecord(q, numBytesPrefix, data, numBytes);
+
+  // compress on the stack first, so that only the compressed length is reserved
+  const int maxBytes = numBytes - 1; // the record is only kept compressed if it is smaller
+  char scratch[TPIPE_COMPRESS_SCRATCH_BYTES];
+  const int scratchBytes = (maxBytes < TPIPE_COMPRESS_SCRATCH_BYTES) ? maxBytes : TPIPE_COMPRESS_SCRATCH_BYTES;
+  const int compressedBytes = tpipe_lzCompress(data, numBytes, scratch, scratchBytes);
+  if (compressedBytes > 0) {
+    return tpipe_lzWriteRecord(q, numBytesPrefix | TPIPE_LZ_COMPRESSED_FLAG, scratch, compressedBytes);
+  }
+  if (scratchBytes == maxBytes) {
+    return tpipe_lzWriteRecord(q, numBytesPrefix, data, numBytes); // incompressible
+  }
+
+  // the record may still compress to more than the scratch space, so compress it
+  // directly into the pipe
+  char *buffer = tpipe_getWriteBuffer(q, (int) sizeof(uint32_t) + maxBytes);
+  if (buffer == NULL) return 0;
+  const int pipeCompressedBytes = tpipe_lzCompress(data, numBytes, buffer + sizeof(uint32_t), maxBytes);
+  if (pipeCompressedBytes > 0) {
+    const uint32_t prefix = numBytesPrefix | TPIPE_LZ_COMPRESSED_FLAG;
+    memcpy(buffer, &prefix, sizeof(prefix));
+    tpipe_produce(q, (int) sizeof(uint32_t) + pipeCompressedBytes);
+    return 1;
+  }
+  return tpipe_lzWriteRecord(q, numBytesPrefix, data, numBytes); // incompressible
+}
+
+int tpipe_getDecompressedSize(TinyPipe *q) {
+  int len = 0;
+  const char *buffer = tpipe_getReadBuffer(q, &len);
+  assert(len >= (int) sizeof(uint32_t));
+  uint32_t prefix;
+  memcpy(&prefix, buffer, sizeof(prefix));
+  return (int) (prefix & ~TPIPE_LZ_COMPRESSED_FLAG);
+}
+
+int tpipe_readCompressed(TinyPipe *q, char *dst, int maxBytes) {
+  int len = 0;
+  const char *buffer = tpipe_getReadBuffer(q, &len);
+  assert(len >= (int) sizeof(uint32_t));
+  uint32_t prefix;
+  memcpy(&prefix, buffer, sizeof(prefix));
+  const int numBytes = (int) (prefix & ~TPIPE_LZ_COMPRESSED_FLAG);
+  if (numBytes > maxBytes) return -1;
+
+  buffer += sizeof(uint32_t);
+  len -= (int) sizeof(uint32_t);
+  if (prefix & TPIPE_LZ_COMPRESSED_FLAG) {
+    return (tpipe_lzDecompress(buffer, len, dst, numBytes) == numBytes) ? numBytes : -1;
+  } else {
+    if (len != numBytes) return -1;
+    memcpy(dst, buffer, numBytes);
+    return numBytes;
+  }
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_LZ_H_
+#define _TINYPIPE_LZ_H_
+
+#include "tinypipe.h"
+
+#ifndef TPIPE_COMPRESS_MIN_BYTES
+#define TPIPE_COMPRESS_MIN_BYTES 128 // shorter records are written uncompressed
+#endif
+
+#ifndef TPIPE_COMPRESS_SCRATCH_BYTES
+#define TPIPE_COMPRESS_SCRATCH_BYTES 4096 // the stack space for compressing a record before reserving it
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * Returns the maximum number of bytes that tpipe_lzCompress() may produce.
+   *
+   * @param numBytes  The number of bytes to compress.
+   */
+  int tpipe_lzGetBound(int numBytes);
+
+  /**
+   * Compresses a block of data with a small LZ77 codec.
+   *
+   * @param src  The data to compress.
+   * @param numBytes  The number of bytes to compress.
+   * @param dst  The buffer to write the compressed data to.
+   * @param maxBytes  The size of the destination buffer.
+   *
+   * @return  The number of compressed bytes. Returns 0 if they do not fit in the
+   *          destination buffer.
+   */
+  int tpipe_lzCompress(const char *src, int numBytes, char *dst, int maxBytes);
+
+  /**
+   * Decompresses a block of data written by tpipe_lzCompress().
+   *
+   * @param src  The compressed data.
+   * @param numBytes  The number of compressed bytes.
+   * @param dst  The buffer to write the decompressed data to.
+   * @param maxBytes  The size of the destination buffer.
+   *
+   * @return  The number of decompressed bytes. Returns -1 if the data is corrupt
+   *          or does not fit in the destination buffer.
+   */
+  int tpipe_lzDecompress(const char *src, int numBytes, char *dst, int maxBytes);
+
+  /**
+   * Writes a number of bytes to the pipe, compressing them if they are at least
+   * TPIPE_COMPRESS_MIN_BYTES long and compressible. Records which compress to at
+   * most TPIPE_COMPRESS_SCRATCH_BYTES are compressed before space is reserved, so
+   * only their compressed length needs to fit in the pipe. Longer records are
+   * compressed directly into the pipe, which needs space for their uncompressed
+   * length. Records written with this function must be read with
+   * tpipe_readCompressed().
+   *
+   * @param q  The pipe.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the pipe. 0 otherwise.
+   */
+  int tpipe_writeCompressed(TinyPipe *q, const char *data, int numBytes);
+
+  /**
+   * Returns the original length of the current record written with
+   * tpipe_writeCompressed().
+   *
+   * @param q  The pipe.
+   */
+  int tpipe_getDecompressedSize(TinyPipe *q);
+
+  /**
+   * Decompresses the current record written with tpipe_writeCompressed(). The
+   * record must still be consumed with tpipe_consume().
+   *
+   * @param q  The pipe.
+   * @param dst  The buffer to write the record to.
+   * @param maxBytes  The size of the buffer.
+   *
+   * @return  The number of bytes written to the buffer. Returns -1 if the record
+   *          is corrupt or does not fit in the buffer.
+   */
+  int tpipe_readCompressed(TinyPipe *q, char *dst, int maxBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_LZ_H_
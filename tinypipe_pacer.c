@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _DEFAULT_SOURCE // for clock_gettime() in strict C modes
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinypipe_pacer.h"
+
+#if (__x86_64__ || __i386__) && __GNUC__
+  #include <pthread.h>
+  #include <x86intrin.h>
+  #define TPIPE_PACER_USE_TSC 1
+#endif
+
+static inline uint64_t tpipe_pacerGetNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t tpipe_pacerGetTicks(void) {
+#if TPIPE_PACER_USE_TSC
+  return (uint64_t) __rdtsc();
+#else
+  return tpipe_pacerGetNanoseconds();
+#endif
+}
+
+#if TPIPE_PACER_USE_TSC
+static double tpipe_pacerTicksPerSecond;
+static pthread_once_t tpipe_pacerCalibrated = PTHREAD_ONCE_INIT;
+
+// Measures the rate of the TSC against CLOCK_MONOTONIC over 10ms.
+static void tpipe_pacerCalibrate(void) {
+  const uint64_t t0 = tpipe_pacerGetNanoseconds();
+  const uint64_t ticks0 = tpipe_pacerGetTicks();
+  uint64_t t1;
+  do {
+    t1 = tpipe_pacerGetNanoseconds();
+  } while ((t1 - t0) < 10000000);
+  tpipe_pacerTicksPerSecond = (double) (tpipe_pacerGetTicks() - ticks0) * 1e9 / (double) (t1 - t0);
+}
+#endif
+
+// Returns the rate of tpipe_pacerGetTicks(), measuring it once for all pacers, on
+// whichever thread first initialises one.
+static double tpipe_pacerGetTicksPerSecond(void) {
+#if TPIPE_PACER_USE_TSC
+  pthread_once(&tpipe_pacerCalibrated, tpipe_pacerCalibrate);
+  return tpipe_pacerTicksPerSecond;
+#else
+  return 1e9;
+#endif
+}
+
+void tpipe_pacerInit(TinyPipePacer *p, double bytesPerSecond, int burstBytes,
+    double messagesPerSecond, int burstMessages) {
+  assert((bytesPerSecond >= 0.0) && (messagesPerSecond >= 0.0));
+  assert((burstBytes > 0) && (burstMessages > 0));
+  const double ticksPerSecond = tpipe_pacerGetTicksPerSecond();
+  p->bytesPerTick = bytesPerSecond / ticksPerSecond;
+  p->messagesPerTick = messagesPerSecond / ticksPerSecond;
+  p->burstBytes = burstBytes;
+  p->burstMessages = burstMessages;
+  p->bytes = p->burstBytes;
+  p->messages = p->burstMessages;
+  p->lastTicks = tpipe_pacerGetTicks();
+}
+
+// Fills the buckets, then returns 1 if they hold enough tokens for a record of the
+// given length. The buckets are filled on every call, even while they hold enough
+// tokens, so that time spent idle with full buckets is not credited to them again
+// when they next run low.
+static int tpipe_pacerAdmit(TinyPipePacer *p, int numBytes) {
+  const uint64_t ticks = tpipe_pacerGetTicks();
+  const double elapsed = (double) (ticks - p->lastTicks);
+  p->lastTicks = ticks;
+  p->bytes += elapsed * p->bytesPerTick;
+  if (p->bytes > p->burstBytes) p->bytes = p->burstBytes;
+  p->messages += elapsed * p->messagesPerTick;
+  if (p->messages > p->burstMessages) p->messages = p->burstMessages;
+  return ((p->bytesPerTick <= 0.0) || (p->bytes >= numBytes))
+      && ((p->messagesPerTick <= 0.0) || (p->messages >= 1.0));
+}
+
+char *tpipe_pacerGetWriteBuffer(TinyPipe *q, TinyPipePacer *p, int numBytes,
+    TinyPipePacerStatus *status) {
+  if (!tpipe_pacerAdmit(p, numBytes)) {
+    *status = TPIPE_PACER_THROTTLED;
+    return NULL;
+  }
+  char *const buffer = tpipe_getWriteBuffer(q, numBytes);
+  *status = (buffer != NULL) ? TPIPE_PACER_WRITTEN : TPIPE_PACER_FULL;
+  return buffer;
+}
+
+void tpipe_pacerProduce(TinyPipe *q, TinyPipePacer *p, int numBytes) {
+  p->bytes -= numBytes;
+  p->messages -= 1.0;
+  tpipe_produce(q, numBytes);
+}
+
+TinyPipePacerStatus tpipe_pacerWrite(TinyPipe *q, TinyPipePacer *p, const char *data,
+    int numBytes) {
+  TinyPipePacerStatus status;
+  char *const buffer = tpipe_pacerGetWriteBuffer(q, p, numBytes, &status);
+  if (buffer == NULL) return status;
+  memcpy(buffer, data, numBytes);
+  tpipe_pacerProduce(q, p, numBytes);
+  return TPIPE_PACER_WRITTEN;
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_PACER_H_
+#define _TINYPIPE_PACER_H_
+
+#include "tinypipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  typedef enum TinyPipePacerStatus {
+    TPIPE_PACER_WRITTEN = 0, // the record was admitted and written
+    TPIPE_PACER_THROTTLED, // the record exceeds the rate limit, try again later
+    TPIPE_PACER_FULL, // the record was admitted but there is no space in the pipe
+  } TinyPipePacerStatus;
+
+  /*
+   * A token bucket limit on the rate of bytes and the rate of records written to
+   * a pipe, kept by the producer. Each bucket fills at its rate up to its burst
+   * size, and every record takes its length from the byte bucket and one token
+   * from the record bucket. Time is read from the TSC on x86 (assuming an
+   * invariant TSC) and from CLOCK_MONOTONIC elsewhere, without system calls.
+   */
+  typedef struct TinyPipePacer {
+    double bytes; // the tokens in the byte bucket
+    double messages; // the tokens in the record bucket
+    double bytesPerTick; // 0 if the byte rate is unlimited
+    double messagesPerTick; // 0 if the record rate is unlimited
+    double burstBytes;
+    double burstMessages;
+    uint64_t lastTicks; // the time at which the buckets were last filled
+  } TinyPipePacer;
+
+  /**
+   * Initialises a pacer with full buckets. On x86 the first call measures the rate
+   * of the TSC, which takes about 10ms, and calls on other threads wait for it.
+   *
+   * @param p  The pacer.
+   * @param bytesPerSecond  The sustained rate of bytes, or 0 for no limit.
+   * @param burstBytes  The greatest number of bytes which may be written at once.
+   *                    This must be at least the length of the longest record.
+   * @param messagesPerSecond  The sustained rate of records, or 0 for no limit.
+   * @param burstMessages  The greatest number of records which may be written at once.
+   */
+  void tpipe_pacerInit(TinyPipePacer *p, double bytesPerSecond, int burstBytes,
+      double messagesPerSecond, int burstMessages);
+
+  /**
+   * Returns a pointer to a location in the pipe where numBytes can be written, if
+   * the pacer admits a record of that length. This function must be called from
+   * the producer thread.
+   *
+   * @param q  The pipe.
+   * @param p  The pacer.
+   * @param numBytes  The number of bytes to be written.
+   * @param status  This value will be filled with TPIPE_PACER_WRITTEN if a buffer
+   *                is returned, or the reason why not.
+   *
+   * @return  A pointer to a location where those bytes can be written. Returns
+   *          NULL if the record is throttled or the pipe is full.
+   */
+  char *tpipe_pacerGetWriteBuffer(TinyPipe *q, TinyPipePacer *p, int numBytes,
+      TinyPipePacerStatus *status);
+
+  /**
+   * Indicates to the pipe how many bytes have been written, and takes them from
+   * the buckets.
+   *
+   * @param q  The pipe.
+   * @param p  The pacer.
+   * @param numBytes  The number of bytes written.
+   */
+  void tpipe_pacerProduce(TinyPipe *q, TinyPipePacer *p, int numBytes);
+
+  /**
+   * A convenience function to write a number of bytes to the pipe, if the pacer
+   * admits them.
+   *
+   * @param q  The pipe.
+   * @param p  The pacer.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return  TPIPE_PACER_WRITTEN if the bytes were written to the pipe,
+   *          TPIPE_PACER_THROTTLED if they exceed the rate limit, or
+   *          TPIPE_PACER_FULL if there is no space in the pipe.
+   */
+  TinyPipePacerStatus tpipe_pacerWrite(TinyPipe *q, TinyPipePacer *p, const char *data,
+      int numBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_PACER_H_
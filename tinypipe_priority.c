@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+
+#include "tinypipe_priority.h"
+
+int tpipe_priorityInit(TinyPipePriority *p, int urgentBytes, int bulkBytes) {
+  p->readLane = TPIPE_LANE_URGENT;
+  return tpipe_init(&p->lanes[TPIPE_LANE_URGENT], urgentBytes)
+      + tpipe_init(&p->lanes[TPIPE_LANE_BULK], bulkBytes);
+}
+
+void tpipe_priorityFree(TinyPipePriority *p) {
+  tpipe_free(&p->lanes[TPIPE_LANE_URGENT]);
+  tpipe_free(&p->lanes[TPIPE_LANE_BULK]);
+}
+
+char *tpipe_priorityGetWriteBuffer(TinyPipePriority *p, TinyPipeLane lane, int numBytes) {
+  assert((lane == TPIPE_LANE_URGENT) || (lane == TPIPE_LANE_BULK));
+  return tpipe_getWriteBuffer(&p->lanes[lane], numBytes);
+}
+
+void tpipe_priorityProduce(TinyPipePriority *p, TinyPipeLane lane, int numBytes) {
+  assert((lane == TPIPE_LANE_URGENT) || (lane == TPIPE_LANE_BULK));
+  tpipe_produce(&p->lanes[lane], numBytes);
+}
+
+int tpipe_priorityWrite(TinyPipePriority *p, TinyPipeLane lane, const char *data, int numBytes) {
+  assert((lane == TPIPE_LANE_URGENT) || (lane == TPIPE_LANE_BULK));
+  return tpipe_write(&p->lanes[lane], (char *) data, numBytes);
+}
+
+int tpipe_priorityHasData(TinyPipePriority *p) {
+  const int urgentBytes = tpipe_hasData(&p->lanes[TPIPE_LANE_URGENT]);
+  if (urgentBytes > 0) {
+    p->readLane = TPIPE_LANE_URGENT;
+    return urgentBytes;
+  }
+  p->readLane = TPIPE_LANE_BULK;
+  return tpipe_hasData(&p->lanes[TPIPE_LANE_BULK]);
+}
+
+TinyPipeLane tpipe_priorityGetReadLane(TinyPipePriority *p) {
+  return p->readLane;
+}
+
+char *tpipe_priorityGetReadBuffer(TinyPipePriority *p, int *numBytes) {
+  return tpipe_getReadBuffer(&p->lanes[p->readLane], numBytes);
+}
+
+void tpipe_priorityConsume(TinyPipePriority *p) {
+  tpipe_consume(&p->lanes[p->readLane]);
+}
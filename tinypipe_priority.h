@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2018 Martin Roth (mhroth@gmail.com).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _TINYPIPE_PRIORITY_H_
+#define _TINYPIPE_PRIORITY_H_
+
+#include "tinypipe.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  typedef enum TinyPipeLane {
+    TPIPE_LANE_URGENT = 0, // small records which must not wait behind bulk data
+    TPIPE_LANE_BULK = 1,
+  } TinyPipeLane;
+
+  /*
+   * A pair of pipes between the same producer and consumer: a small lane for
+   * urgent records and a large lane for bulk data. The consumer reads both
+   * through one set of functions, and always reads the urgent lane first. An
+   * urgent record therefore waits at most for the consumer to finish the record
+   * it is currently reading, however much bulk data is queued. Records are kept
+   * in order within each lane, but not across lanes.
+   *
+   * Each lane is a TinyPipe with its own capacity, and with statistics enabled its
+   * own counters (see tpipe_getStats()).
+   */
+  typedef struct TinyPipePriority {
+    TinyPipe lanes[2]; // indexed by TinyPipeLane
+    TinyPipeLane readLane; // the lane of the consumer's current record
+  } TinyPipePriority;
+
+  /**
+   * Initialises the lanes with the given lengths, in bytes.
+   *
+   * @param p  The priority pipe.
+   * @param urgentBytes  The size of the urgent lane in bytes.
+   * @param bulkBytes  The size of the bulk lane in bytes.
+   *
+   * @return  Returns the total size of the lanes in bytes.
+   */
+  int tpipe_priorityInit(TinyPipePriority *p, int urgentBytes, int bulkBytes);
+
+  /**
+   * Frees the lanes.
+   *
+   * @param p  The priority pipe.
+   */
+  void tpipe_priorityFree(TinyPipePriority *p);
+
+  /**
+   * Returns a pointer to a location in the given lane where numBytes can be
+   * written. This function must be called from the producer thread.
+   *
+   * @param p  The priority pipe.
+   * @param lane  The lane to write to.
+   * @param numBytes  The number of bytes to be written.
+   *
+   * @return  A pointer to a location where those bytes can be written. Returns
+   *          NULL if the lane is full.
+   */
+  char *tpipe_priorityGetWriteBuffer(TinyPipePriority *p, TinyPipeLane lane, int numBytes);
+
+  /**
+   * Indicates to the given lane how many bytes have been written.
+   *
+   * @param p  The priority pipe.
+   * @param lane  The lane passed to the preceding call to tpipe_priorityGetWriteBuffer().
+   * @param numBytes  The number of bytes written.
+   */
+  void tpipe_priorityProduce(TinyPipePriority *p, TinyPipeLane lane, int numBytes);
+
+  /**
+   * A convenience function to write a number of bytes to the given lane.
+   *
+   * @param p  The priority pipe.
+   * @param lane  The lane to write to.
+   * @param data  The data pointer.
+   * @param numBytes  The number of bytes to write.
+   *
+   * @return 1 if bytes were successfully written to the lane. 0 otherwise.
+   */
+  int tpipe_priorityWrite(TinyPipePriority *p, TinyPipeLane lane, const char *data, int numBytes);
+
+  /**
+   * Indicates if data is available for reading in either lane, and selects the
+   * lane of the next record: the urgent lane if it has data, otherwise the bulk
+   * lane. The selection holds until the record is consumed. This function must
+   * be called from the consumer thread.
+   *
+   * @param p  The priority pipe.
+   *
+   * @return Returns the number of bytes available for reading in the selected
+   *         lane. Zero if no bytes are available.
+   */
+  int tpipe_priorityHasData(TinyPipePriority *p);
+
+  /**
+   * Returns the lane of the current record, as selected by tpipe_priorityHasData().
+   *
+   * @param p  The priority pipe.
+   */
+  TinyPipeLane tpipe_priorityGetReadLane(TinyPipePriority *p);
+
+  /**
+   * Returns the current read buffer, indicating the number of bytes available
+   * for reading.
+   *
+   * @param p  The priority pipe.
+   * @param numBytes  This value will be filled with the number of bytes available
+   *                  for reading.
+   *
+   * @return  A pointer to the read buffer.
+   */
+  char *tpipe_priorityGetReadBuffer(TinyPipePriority *p, int *numBytes);
+
+  /**
+   * Indicates that the current record has been read and is no longer needed.
+   *
+   * @param p  The priority pipe.
+   */
+  void tpipe_priorityConsume(TinyPipePriority *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TINYPIPE_PRIORITY_H_